@@ -0,0 +1,51 @@
+// ========== VM ASSEMBLER ==========
+// Translates VM assembly (.asm) into a bytecode image (.vmbc) that Virtual_Emulator loads
+// without parsing:   Virtual_Emulator --program=program.vmbc
+//
+// Usage:
+//   Assembler <input.asm> <output.vmbc> [--strip]
+//   Assembler --builtin <output.vmbc> [--strip]     (the built-in menu program)
+// --strip leaves out the source-line section; tracing then shows disassembled instructions.
+//
+// Build: g++ -std=c++17 -O2 Assembler.cpp -o Assembler
+
+#define VM_NO_MAIN                                              // Reuse the VM's decoder and linker, not its main()
+#include "Virtual_Emulator.cpp"
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        cerr << "Usage: Assembler <input.asm> <output.vmbc> [--strip]" << endl;
+        cerr << "       Assembler --builtin <output.vmbc> [--strip]" << endl;
+        return 1;
+    }
+    string input = argv[1];
+    string output = argv[2];
+    bool includeSource = !(argc > 3 && string(argv[3]) == "--strip");
+
+    VirtualMachine vm(TRACE_OFF);                               // Errors are reported below from LoadErrors()
+    bool loaded;
+    if (input == "--builtin") {
+        loaded = vm.LoadProgramFromLines(BuiltinMenuProgram, sizeof(BuiltinMenuProgram) / sizeof(BuiltinMenuProgram[0]));
+    } else {
+        ifstream source(input);
+        if (!source) {
+            cerr << "Cannot open '" << input << "'" << endl;
+            return 1;
+        }
+        loaded = vm.LoadProgramFromStream(source);
+    }
+    if (!loaded) {                                              // Undefined labels: no image is written
+        for (const string& error : vm.LoadErrors()) cerr << input << ": " << error << endl;
+        return 1;
+    }
+
+    vector<uint8_t> image = vm.BuildBytecodeImage(includeSource);
+    ofstream file(output, ios::out | ios::trunc | ios::binary);
+    file.write((const char*)image.data(), image.size());
+    if (!file) {
+        cerr << "Cannot write '" << output << "'" << endl;
+        return 1;
+    }
+    cout << input << " -> " << output << ": " << image.size() << " bytes" << endl;
+    return 0;
+}
@@ -5,26 +5,1405 @@
 #include <vector>             // Dynamic array container for sequences
 #include <string>             // String class and character operations
 #include <algorithm>          // Algorithms library (sort, find, transform)
-#include <stack>              // Stack container (Last-In-First-Out)
+#include <map>                // Ordered map for the heap free list (address order, coalescing)
+#include <set>                // Ordered set for the heap size-class bins (best fit)
 #include <cstdlib>            // General utilities (memory, conversions, exit)
-#include <conio.h>            // General utilities (memory, conversions, exit)
+#ifdef _WIN32
+#include <conio.h>            // _getch for the CLRSC "press any key" wait
+#else
+#include <termios.h>          // Raw terminal mode for the portable _getch below
+#include <unistd.h>           // read/close
+#include <fcntl.h>            // open("/dev/tty"), open() of bytecode images
+#include <sys/mman.h>         // mmap of bytecode images
+#include <sys/stat.h>         // fstat (image size)
+#endif
+#include <climits>            // Integer limits (INT_MAX, INT_MIN) for overflow checks
+#include <cstdint>            // Fixed-width integer types for the decoded instruction format
+#include <chrono>             // High resolution clock for the built-in benchmarks
+#include <memory>             // unique_ptr for guest memory pages
+#include <cstring>            // memset/memcpy for bulk guest memory access
+#include <cstddef>            // offsetof (JIT frame layout)
+#include <random>             // Random programs for the JIT differential test
 
 using namespace std;          // Use standard namespace to avoid std:: prefix
 
+#ifndef _WIN32
+// conio-style _getch: one unechoed key from the controlling terminal (not from stdin, like
+// the Windows version). Returns 0 without waiting when there is no terminal.
+inline int _getch() {
+    int fd = open("/dev/tty", O_RDONLY);
+    if (fd < 0) return 0;
+    termios saved, raw;
+    if (tcgetattr(fd, &saved) != 0) { close(fd); return 0; }
+    raw = saved;
+    raw.c_lflag &= ~(ICANON | ECHO);                            // No line buffering, no echo
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(fd, TCSANOW, &raw);
+    unsigned char key = 0;
+    ssize_t count = read(fd, &key, 1);
+    tcsetattr(fd, TCSANOW, &saved);
+    close(fd);
+    return (count == 1) ? key : 0;
+}
+#endif
+
+// ========== DISPATCH ENGINE SELECTION ==========
+// Build with -DVM_DISPATCH_MODE=VM_DISPATCH_TABLE or =VM_DISPATCH_THREADED to pick the
+// loop used by run(). Threaded (computed goto) needs the GCC/Clang labels-as-values extension.
+#define VM_DISPATCH_TABLE    0                                  // Function-pointer table indexed by opcode
+#define VM_DISPATCH_THREADED 1                                  // Computed-goto threaded code
+
+#if defined(__GNUC__)
+    #define VM_HAVE_COMPUTED_GOTO 1
+#else
+    #define VM_HAVE_COMPUTED_GOTO 0
+#endif
+
+#ifndef VM_DISPATCH_MODE
+    #if VM_HAVE_COMPUTED_GOTO
+        #define VM_DISPATCH_MODE VM_DISPATCH_THREADED
+    #else
+        #define VM_DISPATCH_MODE VM_DISPATCH_TABLE
+    #endif
+#endif
+
+#if VM_DISPATCH_MODE == VM_DISPATCH_THREADED && !VM_HAVE_COMPUTED_GOTO
+    #error "VM_DISPATCH_THREADED requires a compiler with computed goto (GCC or Clang)"
+#endif
+
+// The native code tier (--jit) emits x86-64 System V code into mmap'ed pages, so it is only
+// built for x86-64 POSIX hosts; elsewhere, or with -DVM_HAVE_JIT=0, --jit runs the interpreter.
+#ifndef VM_HAVE_JIT
+    #if defined(__x86_64__) && !defined(_WIN32)
+        #define VM_HAVE_JIT 1
+    #else
+        #define VM_HAVE_JIT 0
+    #endif
+#endif
+
+#ifndef VM_JIT_THRESHOLD
+    #define VM_JIT_THRESHOLD 50                                 // Visits of a branch target before it is compiled
+#endif
+
+// ========== DECODED INSTRUCTION FORMAT ==========
+// LoadProgram() compiles every source line once into an Instruction, so the
+// execution loop works on opcodes and typed operands instead of re-tokenizing text.
+//
+// VM_OPCODE_LIST(X) is the single opcode table: X(enum suffix, mnemonic, handler suffix).
+// It generates the Opcode enum, the mnemonic table and both dispatch tables, so they
+// can never fall out of order.
+#define VM_OPCODE_LIST(X) \
+    X(NOP, "NOP", Nop)                                                   \
+    X(PUSH, "PUSH", Push)                                                \
+    X(POP, "POP", Pop)                                                   \
+    X(PUSHA, "PUSHA", Pusha)                                             \
+    X(POPA, "POPA", Popa)                                                \
+    X(PUSHM, "PUSHM", Pushm)                                             \
+    X(POPM, "POPM", Popm)                                                \
+    X(ALLOC, "ALLOC", Alloc)                                             \
+    X(FREE, "FREE", Free)                                                \
+    X(HEAP_STATS, "HEAP_STATS", HeapStats)                               \
+    X(STORE, "STORE", Store)                                             \
+    X(LOAD, "LOAD", Load)                                                \
+    X(GET_ELEMENT_ADDR, "GET_ELEMENT_ADDR", GetElementAddr)              \
+    X(MATRIX_ALLOC_MEM, "MATRIX_ALLOC_MEM", MatrixAllocMem)              \
+    X(INPUT_MATRIX_A, "INPUT_MATRIX_A", InputMatrixA)                    \
+    X(INPUT_MATRIX_B, "INPUT_MATRIX_B", InputMatrixB)                    \
+    X(MATRIX_ADD_OPERATION, "MATRIX_ADD_OPERATION", MatrixAddOperation)  \
+    X(DISPLAY_MATRIX_A, "DISPLAY_MATRIX_A", DisplayMatrixA)              \
+    X(DISPLAY_MATRIX_B, "DISPLAY_MATRIX_B", DisplayMatrixB)              \
+    X(DISPLAY_MATRIX_C, "DISPLAY_MATRIX_C", DisplayMatrixC)              \
+    X(FREE_ALL_MATRICES, "FREE_ALL_MATRICES", FreeAllMatrices)           \
+    X(CHECK_ALLOCATED, "CHECK_ALLOCATED", CheckAllocated)                \
+    X(STORE_MATRIX_SIZE, "STORE_MATRIX_SIZE", StoreMatrixSize)           \
+    X(PRINT_STR, "PRINT_STR", PrintStr)                                  \
+    X(READ_INT, "READ_INT", ReadInt)                                     \
+    X(READ_STRING, "READ_STRING", ReadString)                            \
+    X(STRLEN, "STRLEN", Strlen)                                          \
+    X(STRCPY, "STRCPY", Strcpy)                                          \
+    X(STRCAT, "STRCAT", Strcat)                                          \
+    X(STRCMP, "STRCMP", Strcmp)                                          \
+    X(STRREV, "STRREV", Strrev)                                          \
+    X(MOVSB, "MOVSB", Movsb)                                             \
+    X(STOSB, "STOSB", Stosb)                                             \
+    X(LODSB, "LODSB", Lodsb)                                             \
+    X(SCASB, "SCASB", Scasb)                                             \
+    X(CMPSB, "CMPSB", Cmpsb)                                             \
+    X(STD, "STD", Std)                                                   \
+    X(CLD, "CLD", Cld)                                                   \
+    X(WRITE_INT, "WRITE_INT", WriteInt)                                  \
+    X(READ_CHAR, "READ_CHAR", ReadChar)                                  \
+    X(CRLF, "Crlf", Crlf)                                                \
+    X(ADD, "ADD", Add)                                                   \
+    X(SUB, "SUB", Sub)                                                   \
+    X(IDIV, "IDIV", Idiv)                                                \
+    X(IMUL, "IMUL", Imul)                                                \
+    X(MOV, "MOV", Mov)                                                   \
+    X(MOVZX, "MOVZX", Movzx)                                             \
+    X(CMP, "CMP", Cmp)                                                   \
+    X(JE, "JE", Je)                                                      \
+    X(JNE, "JNE", Jne)                                                   \
+    X(JL, "JL", Jl)                                                      \
+    X(JLE, "JLE", Jle)                                                   \
+    X(JGE, "JGE", Jge)                                                   \
+    X(JG, "JG", Jcc)                                                     \
+    X(JA, "JA", Jcc)                                                     \
+    X(JAE, "JAE", Jcc)                                                   \
+    X(JB, "JB", Jcc)                                                     \
+    X(JBE, "JBE", Jcc)                                                   \
+    X(JZ, "JZ", Jcc)                                                     \
+    X(JNZ, "JNZ", Jcc)                                                   \
+    X(JS, "JS", Jcc)                                                     \
+    X(JNS, "JNS", Jcc)                                                   \
+    X(JO, "JO", Jcc)                                                     \
+    X(JNO, "JNO", Jcc)                                                   \
+    X(SETE, "SETE", SetCC)                                               \
+    X(SETNE, "SETNE", SetCC)                                             \
+    X(SETL, "SETL", SetCC)                                               \
+    X(SETGE, "SETGE", SetCC)                                             \
+    X(SETLE, "SETLE", SetCC)                                             \
+    X(SETG, "SETG", SetCC)                                               \
+    X(SETB, "SETB", SetCC)                                               \
+    X(SETAE, "SETAE", SetCC)                                             \
+    X(SETBE, "SETBE", SetCC)                                             \
+    X(SETA, "SETA", SetCC)                                               \
+    X(SETS, "SETS", SetCC)                                               \
+    X(SETNS, "SETNS", SetCC)                                             \
+    X(SETO, "SETO", SetCC)                                               \
+    X(SETNO, "SETNO", SetCC)                                             \
+    X(CMOVE, "CMOVE", CMovCC)                                            \
+    X(CMOVNE, "CMOVNE", CMovCC)                                          \
+    X(CMOVL, "CMOVL", CMovCC)                                            \
+    X(CMOVGE, "CMOVGE", CMovCC)                                          \
+    X(CMOVLE, "CMOVLE", CMovCC)                                          \
+    X(CMOVG, "CMOVG", CMovCC)                                            \
+    X(CMOVB, "CMOVB", CMovCC)                                            \
+    X(CMOVAE, "CMOVAE", CMovCC)                                          \
+    X(CMOVBE, "CMOVBE", CMovCC)                                          \
+    X(CMOVA, "CMOVA", CMovCC)                                            \
+    X(CMOVS, "CMOVS", CMovCC)                                            \
+    X(CMOVNS, "CMOVNS", CMovCC)                                          \
+    X(CMOVO, "CMOVO", CMovCC)                                            \
+    X(CMOVNO, "CMOVNO", CMovCC)                                          \
+    X(JMP, "JMP", Jmp)                                                   \
+    X(CALL, "CALL", Call)                                                \
+    X(RET, "RET", Ret)                                                   \
+    X(INC, "INC", Inc)                                                   \
+    X(DEC, "DEC", Dec)                                                   \
+    X(CDQ, "CDQ", Cdq)                                                   \
+    X(CLRSC, "CLRSC", Clrsc)                                             \
+    X(HALT, "HALT", Halt)
+
+// Superinstructions: frequent instruction sequences dispatched as one unit (string copy /
+// compare loops). They never appear in source or bytecode; a fusion pass picks them when the
+// program is run (see BuildDispatchOps) and they share the dispatch tables with real opcodes.
+// X(enum suffix, description, handler suffix)
+#define VM_SUPERINSTRUCTION_LIST(X) \
+    X(CMP_JE, "CMP+JE", CmpJe)                                           \
+    X(CMP_JNE, "CMP+JNE", CmpJne)                                        \
+    X(CMP_JL, "CMP+JL", CmpJl)                                           \
+    X(CMP_JLE, "CMP+JLE", CmpJle)                                        \
+    X(CMP_JGE, "CMP+JGE", CmpJge)                                        \
+    X(MOVZX_STORE, "MOVZX+MOV", MovzxStore)                              \
+    X(MOVZX_STORE_INC, "MOVZX+MOV+INC", MovzxStoreInc)                   \
+    X(MOVZX_STORE_INC_JMP, "MOVZX+MOV+INC+JMP", MovzxStoreIncJmp)        \
+    X(INC_JMP, "INC+JMP", IncJmp)
+
+// JIT tier pseudo-ops, also only ever placed in the dispatch side table: a visit counter on
+// branch targets, replaced by an entry into native code once the target has been compiled.
+#define VM_JIT_OPCODE_LIST(X) \
+    X(JIT_PROBE, "JIT probe", JitProbe)                                  \
+    X(JIT_ENTER, "JIT entry", JitEnter)
+
+enum Opcode : uint16_t {
+#define VM_OPCODE_ENUM(name, text, handler) OP_##name,
+    VM_OPCODE_LIST(VM_OPCODE_ENUM)
+    OP_COUNT,                                                   // Number of opcodes (table size)
+    OP_SUPER_FIRST = OP_COUNT - 1,                              // Superinstructions are numbered after the real opcodes
+    VM_SUPERINSTRUCTION_LIST(VM_OPCODE_ENUM)
+    VM_JIT_OPCODE_LIST(VM_OPCODE_ENUM)
+#undef VM_OPCODE_ENUM
+    DISPATCH_COUNT                                              // Opcodes + superinstructions + JIT pseudo-ops (dispatch table size)
+};
+
+static const char* const OpcodeNames[OP_COUNT] = {              // Mnemonic text indexed by Opcode
+#define VM_OPCODE_NAME(name, text, handler) text,
+    VM_OPCODE_LIST(VM_OPCODE_NAME)
+#undef VM_OPCODE_NAME
+};
+
+// Conditions tested by Jcc / SETcc / CMOVcc. Listed in (condition, negation) pairs as in the
+// x86 encoding, so cond ^ 1 is the opposite condition; SETcc and CMOVcc follow this order.
+enum Condition : uint8_t {
+    COND_E, COND_NE,                                            // ZF              (equal / zero)
+    COND_L, COND_GE,                                            // SF != OF        (signed less)
+    COND_LE, COND_G,                                            // ZF or SF != OF  (signed less or equal)
+    COND_B, COND_AE,                                            // CF              (unsigned below)
+    COND_BE, COND_A,                                            // CF or ZF        (unsigned below or equal)
+    COND_S, COND_NS,                                            // SF              (negative)
+    COND_O, COND_NO,                                            // OF              (signed overflow)
+    COND_COUNT
+};
+
+inline bool IsSetcc(int opcode) { return opcode >= OP_SETE && opcode <= OP_SETNO; }
+inline bool IsCmovcc(int opcode) { return opcode >= OP_CMOVE && opcode <= OP_CMOVNO; }
+
+inline int ConditionOf(int opcode) {                            // Condition tested by a Jcc/SETcc/CMOVcc (-1 for other opcodes)
+    if (IsSetcc(opcode)) return opcode - OP_SETE;
+    if (IsCmovcc(opcode)) return opcode - OP_CMOVE;
+    switch (opcode) {
+        case OP_JE: case OP_JZ:   return COND_E;
+        case OP_JNE: case OP_JNZ: return COND_NE;
+        case OP_JL:               return COND_L;
+        case OP_JGE:              return COND_GE;
+        case OP_JLE:              return COND_LE;
+        case OP_JG:               return COND_G;
+        case OP_JB:               return COND_B;
+        case OP_JAE:              return COND_AE;
+        case OP_JBE:              return COND_BE;
+        case OP_JA:               return COND_A;
+        case OP_JS:               return COND_S;
+        case OP_JNS:              return COND_NS;
+        case OP_JO:               return COND_O;
+        case OP_JNO:              return COND_NO;
+        default:                  return -1;
+    }
+}
+
+inline bool IsConditionalJump(int opcode) { return opcode >= OP_JE && opcode <= OP_JNO; }
+
+// Repeat prefix of the string primitives (MOVSB, STOSB, LODSB, SCASB, CMPSB), decoded into an
+// immediate first operand; no operand means a single step. REP on SCASB/CMPSB acts as REPE.
+enum RepPrefix : uint8_t { REP_NONE, REP_ALWAYS, REP_WHILE_EQUAL, REP_WHILE_NOT_EQUAL };
+static const char* const RepPrefixNames[] = { "", "REP", "REPE", "REPNE" };
+
+inline bool IsStringPrimitive(int opcode) { return opcode >= OP_MOVSB && opcode <= OP_CMPSB; }
+
+inline int ParseRepPrefix(const string& token) {                // RepPrefix of a prefix mnemonic, or REP_NONE
+    if (token == "REP") return REP_ALWAYS;
+    if (token == "REPE" || token == "REPZ") return REP_WHILE_EQUAL;
+    if (token == "REPNE" || token == "REPNZ") return REP_WHILE_NOT_EQUAL;
+    return REP_NONE;
+}
+
+enum OperandKind : uint8_t {
+    OPND_NONE,                                                  // Operand slot unused
+    OPND_REG,                                                   // value = register number
+    OPND_IMM,                                                   // value = immediate constant
+    OPND_VAR,                                                   // value = VariableId
+    OPND_LABEL,                                                 // value = target instruction index (-1 if unresolved), aux = symbol id of the name
+    OPND_MEM,                                                   // [base + index + value] memory expression
+    OPND_SYMBOL                                                 // value = symbol id (string constant or string buffer name)
+};
+
+enum VariableId : int32_t {                                     // Named VM variables usable as operands
+    VAR_PREV_RESULT, VAR_FIRST_NUM, VAR_SECOND_NUM, VAR_REMAINDER, VAR_USE_PREV,
+    VAR_STRING1_ADDR, VAR_STRING2_ADDR, VAR_STRING1_LENGTH, VAR_STRING2_LENGTH,
+    VAR_MATRIX_ALLOCATED,
+    VAR_COUNT
+};
+
+static const char* const VariableNames[VAR_COUNT] = {
+    "prevResult", "firstNum", "secondNum", "remainder", "usePrev",
+    "string1Addr", "string2Addr", "string1Length", "string2Length",
+    "matrixAllocated"
+};
+
+// Number of general purpose registers R0..R(N-1). The first six keep their x86 roles
+// (R0=EAX, R1=EBX, R2=ECX, R3=EDX, R4=ESI, R5=EDI); override with -DVM_REGISTER_COUNT=N.
+#ifndef VM_REGISTER_COUNT
+    #define VM_REGISTER_COUNT 16
+#endif
+static_assert(VM_REGISTER_COUNT >= 6 && VM_REGISTER_COUNT < 255, "VM_REGISTER_COUNT must be in [6, 254]");
+
+const uint8_t NO_REGISTER = 0xFF;                               // Marks an unused base/index register in a memory operand
+const int MAX_OPERANDS = 5;                                     // GET_ELEMENT_ADDR takes five registers
+const int BYTE_SIZE = 1, WORD_SIZE = 2, DWORD_SIZE = 4;         // Memory access widths (BYTE/WORD/DWORD PTR)
+
+struct Operand {
+    uint8_t kind;                                               // OperandKind
+    uint8_t base;                                               // OPND_MEM: base register or NO_REGISTER
+    uint8_t index;                                              // OPND_MEM: index register or NO_REGISTER
+    uint8_t width;                                              // OPND_MEM: access size in bytes (1 = BYTE, 2 = WORD, 4 = DWORD)
+    int32_t value;                                              // Register number, immediate, variable, target or displacement
+    int32_t aux;                                                // OPND_LABEL: symbol id of the label name
+};
+
+struct Instruction {                                            // Source line numbers live in a side table (see VirtualMachine::lineTable)
+    uint16_t opcode;                                            // Opcode
+    uint8_t operandCount;                                       // Number of used operand slots
+    uint8_t reserved;                                           // Padding (keeps the layout fixed)
+    Operand ops[MAX_OPERANDS];                                  // Typed operands
+};
+static_assert(sizeof(Instruction) == 64, "Instruction should fill exactly one cache line");
+
+struct ResolvedSymbol {                                         // Runtime binding of a symbol-table name
+    const string* text;                                         // Predefined string in stringMemory (nullptr if none)
+    int bufferAddress;                                          // Address of the string buffer with this name
+    bool isBuffer;                                              // True if the name is a string buffer
+};
+
+// ========== BYTECODE IMAGE ==========
+// Assembled program file (.vmbc), written by SaveBytecode / Assembler.cpp and read by LoadBytecode.
+//   header | code: Instruction[codeCount] (decoded form, host layout) | line table | symbol table | label table | buffer table | source lines
+// Line table (present when there are source lines): i32 source line index per instruction
+// Symbol table entries: [u32 length][name][u32 length or BYTECODE_NO_TEXT][string constant text]
+// Label table entries:  [u32 length][name][i32 instruction index]
+// Buffer table entries: [u32 length][name][u32 size]     (BUFFER directives, allocated when the image is installed)
+// Source lines (optional, for tracing): [u32 length][text]
+// Bump VM_BYTECODE_VERSION whenever VM_OPCODE_LIST, VariableId, the Instruction layout or the image layout changes.
+#define VM_BYTECODE_VERSION 7
+const char BYTECODE_MAGIC[4] = { 'V', 'M', 'B', 'C' };
+const uint32_t BYTECODE_BYTE_ORDER = 0x01020304;                // Read back in host order to reject foreign-endian images
+const uint32_t BYTECODE_NO_TEXT = 0xFFFFFFFF;                   // Symbol has no string constant (e.g. a buffer or label name)
+
+struct BytecodeHeader {
+    char magic[4];                                              // "VMBC"
+    uint32_t byteOrder;                                         // BYTECODE_BYTE_ORDER
+    uint16_t version;                                           // VM_BYTECODE_VERSION
+    uint16_t instructionSize;                                   // sizeof(Instruction)
+    uint16_t opcodeCount;                                       // OP_COUNT
+    uint16_t registerCount;                                     // VM_REGISTER_COUNT
+    uint32_t codeOffset, codeCount;
+    uint32_t lineOffset;                                        // codeCount entries when sourceCount != 0
+    uint32_t symbolOffset, symbolCount;
+    uint32_t labelOffset, labelCount;
+    uint32_t bufferOffset, bufferCount;
+    uint32_t sourceOffset, sourceCount;                         // sourceCount = 0: no debug section
+    uint32_t imageSize;                                         // Total file size in bytes
+};
+
+// Read-only bytes of a bytecode image. Files are mmap'ed PROT_READ/MAP_SHARED on POSIX hosts,
+// so the VM executes straight out of the page cache and every VM started from the same file
+// shares one physical copy of its code. On Windows, and for images passed in memory, the bytes
+// are held in an owned buffer instead.
+class ProgramImage {
+    public:
+        ProgramImage() : mapped(nullptr), mappedSize(0) {}
+        ~ProgramImage() { Release(); }
+        ProgramImage(const ProgramImage&) = delete;
+        ProgramImage& operator=(const ProgramImage&) = delete;
+
+        bool Map(const string& filename) {                      // Returns false if the file cannot be opened or mapped
+            Release();
+#ifndef _WIN32
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0) return false;
+            struct stat info;
+            bool ok = fstat(fd, &info) == 0 && info.st_size > 0;
+            if (ok) {
+                void* address = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+                ok = address != MAP_FAILED;
+                if (ok) {
+                    mapped = (const uint8_t*)address;
+                    mappedSize = (size_t)info.st_size;
+                }
+            }
+            close(fd);                                          // The mapping stays valid after close
+            return ok;
+#else
+            ifstream file(filename, ios::in | ios::binary);
+            if (!file) return false;
+            file.seekg(0, ios::end);
+            owned.resize((size_t)file.tellg());
+            file.seekg(0, ios::beg);
+            file.read((char*)owned.data(), owned.size());
+            return (bool)file;
+#endif
+        }
+
+        void Assign(const uint8_t* data, size_t size) {         // Private copy of an image held by the caller
+            Release();
+            owned.assign(data, data + size);
+        }
+
+        void Release() {
+#ifndef _WIN32
+            if (mapped) munmap((void*)mapped, mappedSize);
+#endif
+            mapped = nullptr;
+            mappedSize = 0;
+            owned.clear();
+            owned.shrink_to_fit();
+        }
+
+        void Swap(ProgramImage& other) {
+            swap(mapped, other.mapped);
+            swap(mappedSize, other.mappedSize);
+            owned.swap(other.owned);
+        }
+
+        const uint8_t* Data() const { return mapped ? mapped : owned.data(); }
+        size_t Size() const { return mapped ? mappedSize : owned.size(); }
+        bool IsMapped() const { return mapped != nullptr; }
+
+    private:
+        const uint8_t* mapped;                                  // mmap'ed file, or nullptr
+        size_t mappedSize;
+        vector<uint8_t> owned;                                  // Used when not mapped
+};
+
+// ========== GUEST MEMORY ==========
+// Byte-addressable, page-table-backed linear memory. The page table is indexed by
+// (address >> PAGE_BITS), pages are allocated on first write and reads from unmapped
+// pages return 0. Multi-byte values are stored little-endian, like x86.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    #define HOST_LITTLE_ENDIAN 0
+#else
+    #define HOST_LITTLE_ENDIAN 1                                // x86/x64 and ARM hosts (MSVC targets are all little-endian)
+#endif
+
+class PagedMemory {
+    public:
+        static const int PAGE_BITS = 12;                        // 4 KiB pages
+        static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+        static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+
+        uint32_t Read(int address, int width = DWORD_SIZE) const { // Little-endian load of 1, 2 or 4 bytes (0 if never written)
+            uint32_t offset = (uint32_t)address & PAGE_MASK;
+            if (offset + width > PAGE_SIZE) {                   // Access straddles two pages: assemble byte by byte
+                uint32_t value = 0;
+                for (int i = 0; i < width; i++) {
+                    value |= Read(address + i, BYTE_SIZE) << (8 * i);
+                }
+                return value;
+            }
+            const uint8_t* bytes = PageOf(address);
+            if (!bytes) return 0;
+            bytes += offset;
+            switch (width) {
+                case BYTE_SIZE: return bytes[0];
+                case WORD_SIZE: return bytes[0] | (bytes[1] << 8);
+                default:
+#if HOST_LITTLE_ENDIAN
+                    uint32_t value;
+                    memcpy(&value, bytes, sizeof(value));       // Same byte order as the guest: single 4-byte load
+                    return value;
+#else
+                    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+#endif
+            }
+        }
+
+        void Write(int address, uint32_t value, int width = DWORD_SIZE) { // Little-endian store of 1, 2 or 4 bytes
+            uint32_t offset = (uint32_t)address & PAGE_MASK;
+            if (offset + width > PAGE_SIZE) {                   // Access straddles two pages: store byte by byte
+                for (int i = 0; i < width; i++) {
+                    Write(address + i, value >> (8 * i), BYTE_SIZE);
+                }
+                return;
+            }
+            uint8_t* bytes = MapPage(address) + offset;
+#if HOST_LITTLE_ENDIAN
+            if (width == DWORD_SIZE) {                          // Same byte order as the guest: single 4-byte store
+                memcpy(bytes, &value, sizeof(value));
+                return;
+            }
+#endif
+            bytes[0] = (uint8_t)value;
+            if (width >= WORD_SIZE) bytes[1] = (uint8_t)(value >> 8);
+            if (width == DWORD_SIZE) {
+                bytes[2] = (uint8_t)(value >> 16);
+                bytes[3] = (uint8_t)(value >> 24);
+            }
+        }
+
+        void Fill(int address, int size, uint8_t value) {       // Set every byte of [address, address + size) to value
+            while (size > 0) {
+                uint32_t offset = (uint32_t)address & PAGE_MASK;
+                int chunk = (int)min<uint32_t>(PAGE_SIZE - offset, (uint32_t)size); // Bytes left in this page
+                if (value != 0 || PageOf(address)) {            // Unmapped pages already read as 0
+                    memset(MapPage(address) + offset, value, chunk);
+                }
+                address += chunk;
+                size -= chunk;
+            }
+        }
+
+        void ReadBlock(int address, uint8_t* out, int size) const { // Copy [address, address + size) out, page by page
+            while (size > 0) {
+                uint32_t offset = (uint32_t)address & PAGE_MASK;
+                int chunk = (int)min<uint32_t>(PAGE_SIZE - offset, (uint32_t)size);
+                const uint8_t* page = PageOf(address);
+                if (page) memcpy(out, page + offset, chunk); else memset(out, 0, chunk);
+                address += chunk;
+                out += chunk;
+                size -= chunk;
+            }
+        }
+
+        void WriteBlock(int address, const uint8_t* in, int size) { // Copy size bytes in at address, page by page
+            while (size > 0) {
+                uint32_t offset = (uint32_t)address & PAGE_MASK;
+                int chunk = (int)min<uint32_t>(PAGE_SIZE - offset, (uint32_t)size);
+                memcpy(MapPage(address) + offset, in, chunk);
+                address += chunk;
+                in += chunk;
+                size -= chunk;
+            }
+        }
+
+        void Copy(int dst, int src, int size) {                 // memmove inside guest memory (overlap-safe), page by page
+            bool backward = (uint32_t)dst > (uint32_t)src && (uint32_t)dst - (uint32_t)src < (uint32_t)size;
+            while (size > 0) {
+                uint32_t from, to;                              // Start of this chunk in src and dst
+                int chunk;
+                if (!backward) {
+                    from = (uint32_t)src;
+                    to = (uint32_t)dst;
+                    chunk = (int)min({ PAGE_SIZE - (from & PAGE_MASK), PAGE_SIZE - (to & PAGE_MASK), (uint32_t)size });
+                    src += chunk;
+                    dst += chunk;
+                } else {                                        // Overlapping with dst above src: copy from the end
+                    uint32_t fromEnd = (uint32_t)src + size, toEnd = (uint32_t)dst + size;
+                    chunk = (int)min({ ((fromEnd - 1) & PAGE_MASK) + 1, ((toEnd - 1) & PAGE_MASK) + 1, (uint32_t)size });
+                    from = fromEnd - chunk;
+                    to = toEnd - chunk;
+                }
+                const uint8_t* source = PageOf((int)from);
+                if (source) {
+                    memmove(MapPage((int)to) + (to & PAGE_MASK), source + (from & PAGE_MASK), chunk);
+                } else if (PageOf((int)to)) {                   // Unmapped source reads as zeros
+                    memset(MapPage((int)to) + (to & PAGE_MASK), 0, chunk);
+                }
+                size -= chunk;
+            }
+        }
+
+        const uint8_t* Span(int address, int& length) const {   // Host view of length bytes at address, length clipped to the page; nullptr if unmapped
+            uint32_t offset = (uint32_t)address & PAGE_MASK;
+            length = (int)min<uint32_t>(PAGE_SIZE - offset, (uint32_t)length);
+            const uint8_t* page = PageOf(address);
+            return page ? page + offset : nullptr;
+        }
+
+        int FindByte(int address, uint8_t value, int limit) const { // Offset of the first byte == value within limit bytes, or -1
+            for (int offset = 0; offset < limit;) {
+                uint32_t at = (uint32_t)address + offset;
+                int chunk = (int)min<uint32_t>(PAGE_SIZE - (at & PAGE_MASK), (uint32_t)(limit - offset));
+                const uint8_t* page = PageOf((int)at);
+                if (!page) {
+                    if (value == 0) return offset;              // Unmapped pages read as 0
+                } else if (const void* hit = memchr(page + (at & PAGE_MASK), value, chunk)) {
+                    return offset + (int)((const uint8_t*)hit - (page + (at & PAGE_MASK)));
+                }
+                offset += chunk;
+            }
+            return -1;
+        }
+
+        size_t MappedPages() const {                            // Number of pages currently backed by host memory
+            size_t count = 0;
+            for (const auto& page : pages) {
+                if (page) count++;
+            }
+            return count;
+        }
+
+        size_t FootprintBytes() const {                         // Host memory used by pages plus the page table
+            return MappedPages() * PAGE_SIZE + pages.capacity() * sizeof(pages[0]);
+        }
+
+    private:
+        vector<unique_ptr<uint8_t[]>> pages;                    // Page table (null entries are unmapped)
+
+        const uint8_t* PageOf(int address) const {              // Page holding address, or nullptr if unmapped
+            uint32_t page = (uint32_t)address >> PAGE_BITS;
+            return (page < pages.size()) ? pages[page].get() : nullptr;
+        }
+
+        uint8_t* MapPage(int address) {                         // Page holding address, allocated (zeroed) on first touch
+            uint32_t page = (uint32_t)address >> PAGE_BITS;
+            if (page >= pages.size()) pages.resize(page + 1);
+            if (!pages[page]) pages[page].reset(new uint8_t[PAGE_SIZE]());
+            return pages[page].get();
+        }
+};
+
+// ========== GUEST HEAP ==========
+// Segregated free-list allocator behind ALLOC/FREE. Live blocks are kept in a hash map
+// keyed by base address, so FREE finds a whole block in O(1) without touching its bytes.
+// Freed ranges are coalesced with free neighbours and binned by size class (power of two);
+// allocation takes the best fit from the smallest non-empty class and splits off the rest.
+// A free range that reaches the top of the heap is handed back to the bump region.
+struct HeapStats {
+    int liveBytes;                                              // Bytes in live blocks
+    int peakLiveBytes;                                          // High-water mark of liveBytes
+    int liveBlocks;                                             // Number of live blocks
+    int freeBytes;                                              // Bytes sitting in the free lists
+    int freeBlocks;                                             // Number of free ranges
+    int largestFreeBlock;                                       // Biggest single free range
+    int heapBytes;                                              // Heap top - heap base
+    double fragmentation;                                       // 1 - largestFreeBlock / freeBytes (0 = one contiguous hole)
+};
+
+class HeapAllocator {
+    public:
+        static const int ALIGNMENT = 4;                         // Every block starts DWORD aligned
+        static const int SIZE_CLASSES = 32;                     // One bin per power of two
+
+        explicit HeapAllocator(int base) : heapBase(base), heapTop(base) {}
+
+        int MaxBlockSize() const {                              // Largest request that can ever succeed (the whole address space above heapBase)
+            return (INT_MAX - heapBase) & ~(ALIGNMENT - 1);
+        }
+
+        int Allocate(int size) {                                // Returns base address of a block of at least size bytes, 0 if it cannot fit
+            if (size < 0 || size > MaxBlockSize()) return 0;    // Checked before rounding, which would overflow
+            int blockSize = RoundUp(size);
+            int address = TakeFreeBlock(blockSize);
+            if (address == 0) {                                 // No free range fits: grow the heap
+                if (blockSize > INT_MAX - heapTop) return 0;    // Address space above the heap is exhausted
+                address = heapTop;
+                heapTop += blockSize;
+            }
+            liveBlocks[address] = LiveBlock{blockSize, max(size, 1)};
+            liveBytes += blockSize;
+            peakLiveBytes = max(peakLiveBytes, liveBytes);
+            return address;
+        }
+
+        int Free(int address) {                                 // Returns the freed block size, or 0 if address is not a live block
+            auto it = liveBlocks.find(address);
+            if (it == liveBlocks.end()) return 0;
+            int blockSize = it->second.size;
+            liveBlocks.erase(it);
+            liveBytes -= blockSize;
+            ReleaseRange(address, blockSize);
+            return blockSize;
+        }
+
+        int BlockSize(int address) const {                      // Bytes the program asked for at address (0 if no live block starts there);
+            auto it = liveBlocks.find(address);                 // the rounding slack after them is not part of the block
+            return (it == liveBlocks.end()) ? 0 : it->second.requested;
+        }
+
+        HeapStats Stats() const {
+            HeapStats stats = {liveBytes, peakLiveBytes, (int)liveBlocks.size(), 0, (int)freeRanges.size(), 0, heapTop - heapBase, 0.0};
+            for (const auto& range : freeRanges) {
+                stats.freeBytes += range.second;
+                stats.largestFreeBlock = max(stats.largestFreeBlock, range.second);
+            }
+            if (stats.freeBytes > 0) {
+                stats.fragmentation = 1.0 - (double)stats.largestFreeBlock / stats.freeBytes;
+            }
+            return stats;
+        }
+
+    private:
+        int heapBase;                                           // First heap address (never 0, so 0 means "no block")
+        int heapTop;                                            // End of the heap; everything above is untouched
+        int liveBytes = 0;
+        int peakLiveBytes = 0;
+        struct LiveBlock {
+            int size;                                           // Bytes taken from the heap (rounded up to ALIGNMENT)
+            int requested;                                      // Bytes asked for (at least 1): the bound of string operations
+        };
+        unordered_map<int, LiveBlock> liveBlocks;               // Base address -> block
+        map<int, int> freeRanges;                               // Free base address -> size, ordered for coalescing
+        set<pair<int, int>> bins[SIZE_CLASSES];                 // Per size class: (size, address), ordered for best fit
+
+        static int RoundUp(int size) {
+            if (size < 1) size = 1;                             // Zero-byte requests still get a distinct address
+            return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        }
+
+        static int SizeClass(int size) {                        // floor(log2(size))
+            int sizeClass = 0;
+            while ((size >>= 1) != 0 && sizeClass < SIZE_CLASSES - 1) sizeClass++;
+            return sizeClass;
+        }
+
+        void AddFreeRange(int address, int size) {
+            freeRanges[address] = size;
+            bins[SizeClass(size)].insert(make_pair(size, address));
+        }
+
+        void RemoveFreeRange(int address, int size) {
+            freeRanges.erase(address);
+            bins[SizeClass(size)].erase(make_pair(size, address));
+        }
+
+        int TakeFreeBlock(int size) {                           // Best fit from the free lists, or 0
+            for (int sizeClass = SizeClass(size); sizeClass < SIZE_CLASSES; sizeClass++) {
+                auto it = bins[sizeClass].lower_bound(make_pair(size, INT_MIN));
+                if (it == bins[sizeClass].end()) continue;
+                int rangeSize = it->first, address = it->second;
+                RemoveFreeRange(address, rangeSize);
+                if (rangeSize > size) {                         // Split: the tail stays free (its neighbours are live)
+                    AddFreeRange(address + size, rangeSize - size);
+                }
+                return address;
+            }
+            return 0;
+        }
+
+        void ReleaseRange(int address, int size) {              // Coalesce with both neighbours, then bin or trim the heap
+            auto next = freeRanges.find(address + size);
+            if (next != freeRanges.end()) {
+                int nextSize = next->second;
+                RemoveFreeRange(address + size, nextSize);
+                size += nextSize;
+            }
+            auto prev = freeRanges.lower_bound(address);
+            if (prev != freeRanges.begin()) {
+                --prev;
+                if (prev->first + prev->second == address) {
+                    int prevAddress = prev->first, prevSize = prev->second;
+                    RemoveFreeRange(prevAddress, prevSize);
+                    address = prevAddress;
+                    size += prevSize;
+                }
+            }
+            if (address + size == heapTop) {
+                heapTop = address;                              // Top of the heap: give it back to the bump region
+            } else {
+                AddFreeRange(address, size);
+            }
+        }
+};
+
+// ========== STACKS ==========
+// Call and data stacks hold a fixed number of entries, allocated once per VM (SetStackCapacity).
+// Push/Pop report overflow and underflow instead of growing; the VM turns that into a guest
+// fault. Override the default depths with -DVM_CALL_STACK_DEPTH=N / -DVM_DATA_STACK_DEPTH=N.
+#ifndef VM_CALL_STACK_DEPTH
+    #define VM_CALL_STACK_DEPTH 1024                            // Return addresses (nested CALLs)
+#endif
+#ifndef VM_DATA_STACK_DEPTH
+    #define VM_DATA_STACK_DEPTH 4096                            // PUSHed values
+#endif
+
+class BoundedStack {
+    public:
+        explicit BoundedStack(int capacity) { Reserve(capacity); }
+
+        void Reserve(int capacity) {                            // Set the capacity (allocates once) and empty the stack
+            slots.assign(capacity, 0);
+            depth = 0;
+        }
+
+        bool Push(int32_t value) {                              // False on overflow
+            if (depth == (int)slots.size()) return false;
+            slots[depth++] = value;
+            return true;
+        }
+
+        bool Pop(int32_t& value) {                              // False on underflow
+            if (depth == 0) return false;
+            value = slots[--depth];
+            return true;
+        }
+
+        bool PushBlock(const int32_t* values, int count) {      // values[0] first: one copy; false (nothing pushed) on overflow
+            if (count > (int)slots.size() - depth) return false;
+            memcpy(slots.data() + depth, values, count * sizeof(int32_t));
+            depth += count;
+            return true;
+        }
+
+        bool PopBlock(int32_t* values, int count) {             // Inverse of PushBlock (values[0] = deepest); false on underflow
+            if (count > depth) return false;
+            depth -= count;
+            memcpy(values, slots.data() + depth, count * sizeof(int32_t));
+            return true;
+        }
+
+        int Size() const { return depth; }
+        int Capacity() const { return (int)slots.size(); }
+
+    private:
+        vector<int32_t> slots;                                  // Fixed storage, slots[0] is the bottom
+        int depth = 0;                                          // Number of entries in use
+};
+
+// ========== GUEST OUTPUT ==========
+// Buffered output channel for everything the guest program prints (PRINT_STR, WRITE_INT,
+// Crlf, matrix prompts and displays). Text is collected in a fixed buffer and handed to the
+// sink only at flush points: before input instructions, CLRSC and HALT, before any trace
+// line, at the end of a run, or when the buffer fills. The sink is stdout, a file, or an
+// in-memory string for batch runs.
+class GuestOutput {
+    public:
+        static const size_t BUFFER_SIZE = 64 * 1024;
+
+        GuestOutput() : buffer(new char[BUFFER_SIZE]), used(0), sink(&cout) {}
+        ~GuestOutput() { Flush(); }
+
+        void ToStdout() { Flush(); sink = &cout; }
+        bool ToFile(const string& path) {                       // Returns false if the file cannot be created
+            Flush();
+            file.close();
+            file.open(path, ios::out | ios::trunc | ios::binary);
+            sink = file.is_open() ? &file : &cout;
+            return file.is_open();
+        }
+        void ToMemory() { Flush(); captured.clear(); sink = nullptr; }
+        const string& Captured() { Flush(); return captured; } // Everything written while the memory sink was active
+
+        void Write(const char* data, size_t length) {
+            if (used + length > BUFFER_SIZE) {
+                Drain();
+                if (length > BUFFER_SIZE) { Emit(data, length); return; } // Larger than the buffer: pass straight through
+            }
+            memcpy(buffer.get() + used, data, length);
+            used += length;
+        }
+
+        void Flush() {                                          // Hand buffered text to the sink and flush the sink
+            Drain();
+            if (sink) sink->flush();
+        }
+
+        GuestOutput& operator<<(const string& text) { Write(text.data(), text.size()); return *this; }
+        GuestOutput& operator<<(const char* text) { Write(text, strlen(text)); return *this; }
+        GuestOutput& operator<<(char c) {
+            if (used == BUFFER_SIZE) Drain();
+            buffer[used++] = c;
+            return *this;
+        }
+        GuestOutput& operator<<(int value) {                    // Decimal, like cout << int
+            char digits[16];
+            int length = snprintf(digits, sizeof(digits), "%d", value);
+            Write(digits, length);
+            return *this;
+        }
+
+    private:
+        unique_ptr<char[]> buffer;
+        size_t used;                                            // Bytes pending in buffer
+        ostream* sink;                                          // cout or file; nullptr = in-memory capture
+        ofstream file;
+        string captured;
+
+        void Emit(const char* data, size_t length) {
+            if (sink) sink->write(data, length); else captured.append(data, length);
+        }
+
+        void Drain() {                                          // Hand pending bytes to the sink without flushing it
+            if (used) Emit(buffer.get(), used);
+            used = 0;
+        }
+};
+
+// ========== NATIVE CODE TIER (JIT) ==========
+// With --jit, branch targets count their visits; once one reaches VM_JIT_THRESHOLD the run of
+// JIT-able instructions starting there (a "region") is compiled to x86-64 and later visits
+// jump into the native code. Regions cover MOV, ADD, SUB, IMUL, IDIV, CMP, INC, DEC, MOVZX,
+// MOV <size> PTR and the jumps; the first instruction outside that subset (I/O, stack, matrix,
+// CALL, ...) ends the region and hands control back to the interpreter. Jumps to targets inside
+// the region stay native, so a whole loop runs without dispatch. The generated code keeps the
+// VM's own flag rules (MOV sets ZF/SF, IMUL/IDIV set fixed flags), so results match the
+// interpreter exactly; "--test-jit" checks that on random programs.
+class VirtualMachine;
+
+struct JitFrame {                                               // Guest state handed to native code (System V: rdi)
+    int32_t regs[VM_REGISTER_COUNT];                            // Guest registers (copied in and out by ExecuteJitEnter)
+    uint8_t zf, sf, of, cf;                                     // Status flags, one byte each (set with SETcc)
+    VirtualMachine* vm;                                         // For the guest memory helpers
+};
+
+typedef int32_t (*JitFunction)(JitFrame*);                      // Returns the next PC, or ~PC to have the interpreter run PC
+typedef uint32_t (*JitLoadHelper)(JitFrame*, int32_t address, int32_t width);
+typedef void (*JitStoreHelper)(JitFrame*, int32_t address, int32_t value, int32_t width);
+
+// Minimal x86-64 encoder for the instructions the region compiler needs. 32-bit forms unless
+// the name says 64; memory operands are [base + disp].
+class X64Emitter {
+    public:
+        enum Reg { RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI, R8, R9, R10, R11, R12, R13, R14, R15 };
+        enum Cond { CC_O = 0x0, CC_B = 0x2, CC_E = 0x4, CC_NE = 0x5, CC_S = 0x8 }; // Condition codes used (inverse = cc ^ 1)
+        enum Alu { ALU_ADD = 0x01, ALU_OR = 0x09, ALU_AND = 0x21, ALU_SUB = 0x29, ALU_XOR = 0x31, ALU_CMP = 0x39, ALU_TEST = 0x85 };
+
+        vector<uint8_t>& Code() { return code; }
+        size_t Size() const { return code.size(); }
+
+        void Push(Reg r) { if (r >= R8) Byte(0x41); Byte(0x50 + (r & 7)); }
+        void Pop(Reg r)  { if (r >= R8) Byte(0x41); Byte(0x58 + (r & 7)); }
+        void Ret() { Byte(0xC3); }
+        void Call(Reg r) { if (r >= R8) Byte(0x41); Byte(0xFF); Byte(0xD0 + (r & 7)); }
+
+        void Mov(Reg dst, Reg src) { if (dst != src) RR(0x89, src, dst); }
+        void Mov64(Reg dst, Reg src) { RR(0x89, src, dst, true); }
+        void MovImm(Reg dst, int32_t imm) { if (dst >= R8) Byte(0x41); Byte(0xB8 + (dst & 7)); Imm32(imm); }
+        void MovImm64(Reg dst, uint64_t imm) {
+            Byte(0x48 | (dst >= R8 ? 1 : 0));
+            Byte(0xB8 + (dst & 7));
+            for (int i = 0; i < 8; i++) Byte((uint8_t)(imm >> (8 * i)));
+        }
+        void Load(Reg dst, Reg base, int32_t disp) { RM(0x8B, dst, base, disp); }   // mov dst, [base + disp]
+        void Store(Reg base, int32_t disp, Reg src) { RM(0x89, src, base, disp); }  // mov [base + disp], src
+        void StoreByte(Reg base, int32_t disp, Reg src) { RM(0x88, src, base, disp, false, true); }
+        void StoreByteImm(Reg base, int32_t disp, uint8_t imm) { RM(0xC6, RAX, base, disp); Byte(imm); }
+        void LoadByte(Reg dst, Reg base, int32_t disp) { RM(0x8A, dst, base, disp, false, true); }  // mov dst8, [base + disp]
+        void AluByte(Alu op, Reg dst, Reg base, int32_t disp) { RM(op + 1, dst, base, disp, false, true); } // op dst8, [base + disp]
+        void CmpByteImm(Reg base, int32_t disp, uint8_t imm) { RM(0x80, (Reg)7, base, disp); Byte(imm); }
+
+        void Op(Alu op, Reg dst, Reg src) { RR(op, src, dst); }                    // add/sub/cmp/... dst, src
+        void OpMem(Alu op, Reg dst, Reg base, int32_t disp) { RM(op + 2, dst, base, disp); } // op dst, [base + disp]
+        void OpImm(Alu op, Reg dst, int32_t imm, bool wide = false) {              // op dst, imm (not TEST)
+            RR(0x81, (Reg)(op >> 3), dst, wide);                                   // 81 /digit: the digit is op >> 3
+            Imm32(imm);
+        }
+        void Imul(Reg dst, Reg src) { RR(0x0FAF, dst, src); }
+        void Movsxd(Reg dst, Reg src) { RR(0x63, dst, src, true); }                // 64-bit sign extension of src32
+        void Shl64(Reg dst, uint8_t count) { RR(0xC1, (Reg)4, dst, true); Byte(count); }
+        void Or64(Reg dst, Reg src) { RR(0x09, src, dst, true); }
+        void Cqo() { Byte(0x48); Byte(0x99); }
+        void Idiv64(Reg src) { RR(0xF7, (Reg)7, src, true); }
+        void SetCC(Cond cc, Reg dst) { RR(0x0F90 + cc, RAX, dst, false, true); }
+        void SetCC(Cond cc, Reg base, int32_t disp) { RM(0x0F90 + cc, RAX, base, disp); }
+        void Cmov(Cond cc, Reg dst, Reg src) { RR(0x0F40 + cc, dst, src); }       // cmovcc dst, src
+
+        size_t Jmp() { Byte(0xE9); return Rel32(); }                               // Returns the offset to Patch()
+        size_t Jcc(Cond cc) { Byte(0x0F); Byte(0x80 + cc); return Rel32(); }
+        void Patch(size_t at, size_t target) {
+            int32_t rel = (int32_t)(target - (at + 4));
+            memcpy(&code[at], &rel, sizeof(rel));
+        }
+
+    private:
+        vector<uint8_t> code;
+
+        void Byte(uint8_t b) { code.push_back(b); }
+        void Imm32(int32_t imm) { for (int i = 0; i < 4; i++) Byte((uint8_t)(imm >> (8 * i))); }
+        size_t Rel32() { size_t at = code.size(); Imm32(0); return at; }
+
+        static bool NeedsRex8(int reg) { return reg >= RSP && reg <= RDI; } // SPL..DIL (without REX these encode AH..BH)
+
+        void Prefix(int opcode, int reg, int rm, bool wide, bool forceRex) { // REX prefix (when needed), then the opcode
+            uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((rm & 8) ? 1 : 0);
+            if (rex != 0x40 || forceRex) Byte(rex);
+            if (opcode > 0xFF) Byte((uint8_t)(opcode >> 8));
+            Byte((uint8_t)opcode);
+        }
+        void RR(int opcode, Reg reg, Reg rm, bool wide = false, bool byteRegs = false) {
+            Prefix(opcode, reg, rm, wide, byteRegs && (NeedsRex8(reg) || NeedsRex8(rm)));
+            Byte(0xC0 | ((reg & 7) << 3) | (rm & 7));
+        }
+        void RM(int opcode, Reg reg, Reg base, int32_t disp, bool wide = false, bool byteRegs = false) {
+            Prefix(opcode, reg, base, wide, byteRegs && NeedsRex8(reg));
+            bool shortDisp = disp >= -128 && disp <= 127;
+            Byte((shortDisp ? 0x40 : 0x80) | ((reg & 7) << 3) | (base & 7));
+            if ((base & 7) == RSP) Byte(0x24);                  // SIB for [rsp/r12 + disp]
+            if (shortDisp) Byte((uint8_t)disp); else Imm32(disp);
+        }
+};
+
+// Page-aligned executable copy of one compiled region. The pages are written while
+// PROT_READ|PROT_WRITE and then switched to PROT_READ|PROT_EXEC, never both at once.
+class ExecutableMemory {
+    public:
+        ExecutableMemory() : base(nullptr), size(0) {}
+        ~ExecutableMemory() { Release(); }
+        ExecutableMemory(const ExecutableMemory&) = delete;
+        ExecutableMemory& operator=(const ExecutableMemory&) = delete;
+
+        bool Install(const vector<uint8_t>& code) {             // Returns false if the pages cannot be mapped or protected
+            Release();
+#if VM_HAVE_JIT
+            size_t page = (size_t)sysconf(_SC_PAGESIZE);
+            size_t length = (code.size() + page - 1) / page * page;
+            void* address = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (address == MAP_FAILED) return false;
+            memcpy(address, code.data(), code.size());
+            if (mprotect(address, length, PROT_READ | PROT_EXEC) != 0) {
+                munmap(address, length);
+                return false;
+            }
+            base = address;
+            size = length;
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        void Release() {
+#if VM_HAVE_JIT
+            if (base) munmap(base, size);
+#endif
+            base = nullptr;
+            size = 0;
+        }
+
+        JitFunction Entry() const { return reinterpret_cast<JitFunction>(base); }
+
+    private:
+        void* base;
+        size_t size;
+};
+
+// Compiles one region of decoded instructions into native code. Up to five of the region's most
+// used guest registers live in callee-saved host registers (rbx, rbp, r12-r14) for the whole
+// region; the rest stay in the JitFrame (r15). Flags are stored into the frame by each
+// instruction that sets them. Guest memory goes through the load/store helpers.
+class JitCompiler {
+    public:
+        static const int MAX_REGION = 256;                      // Instructions per region
+
+        JitCompiler(const Instruction* program, int programLength, JitLoadHelper load, JitStoreHelper store)
+            : program(program), programLength(programLength), load(load), store(store) {}
+
+        static bool Supported(const Instruction& ins) {         // True if ins can be part of a region
+            const Operand* ops = ins.ops;
+            auto isValue = [](const Operand& op) { return op.kind == OPND_REG || op.kind == OPND_IMM; };
+            switch (ins.opcode) {
+                case OP_NOP:   return true;
+                case OP_MOV:   return (ops[0].kind == OPND_REG && (isValue(ops[1]) || ops[1].kind == OPND_MEM)) ||
+                                      (ops[0].kind == OPND_MEM && isValue(ops[1]));
+                case OP_ADD: case OP_SUB: case OP_IMUL:
+                               return ops[0].kind == OPND_REG && isValue(ops[1]);
+                case OP_CMP:   return isValue(ops[0]) && isValue(ops[1]);
+                case OP_IDIV:  return isValue(ops[0]);
+                case OP_INC: case OP_DEC:
+                               return ops[0].kind == OPND_REG;
+                case OP_MOVZX: return ops[0].kind == OPND_REG && ops[1].kind == OPND_MEM;
+                case OP_JMP:   return ops[0].kind == OPND_LABEL && ops[0].value >= 0;
+                default:
+                    if (IsConditionalJump(ins.opcode)) return ops[0].kind == OPND_LABEL && ops[0].value >= 0;
+                    if (IsSetcc(ins.opcode)) return ops[0].kind == OPND_REG;
+                    if (IsCmovcc(ins.opcode)) return ops[0].kind == OPND_REG && isValue(ops[1]);
+                    return false;
+            }
+        }
+
+        bool Compile(int start, vector<uint8_t>& out) {         // Region starting at start; false if start is not JIT-able
+            regionStart = start;
+            regionEnd = start;
+            while (regionEnd < programLength && regionEnd - start < MAX_REGION && Supported(program[regionEnd])) regionEnd++;
+            if (regionEnd == start) return false;
+            AssignRegisters();
+
+            static const X64Emitter::Reg saved[] = { X64Emitter::RBX, X64Emitter::RBP, X64Emitter::R12, X64Emitter::R13, X64Emitter::R14, X64Emitter::R15 };
+            for (X64Emitter::Reg reg : saved) a.Push(reg);
+            a.OpImm(X64Emitter::ALU_SUB, X64Emitter::RSP, 8, true); // 6 pushes + return address: realign to 16 for helper calls
+            a.Mov64(X64Emitter::R15, X64Emitter::RDI);
+            for (int g = 0; g < VM_REGISTER_COUNT; g++) {
+                if (home[g] >= 0) a.Load(Host(g), X64Emitter::R15, RegOffset(g));
+            }
+
+            labels.assign(regionEnd - start, 0);
+            for (int pc = start; pc < regionEnd; pc++) {
+                labels[pc - start] = a.Size();
+                Emit(pc, program[pc]);
+            }
+            Exit(regionEnd);                                    // Fell off the end of the region
+
+            size_t epilogue = a.Size();                         // Common exit: eax = next PC
+            for (int g = 0; g < VM_REGISTER_COUNT; g++) {
+                if (home[g] >= 0) a.Store(X64Emitter::R15, RegOffset(g), Host(g));
+            }
+            a.OpImm(X64Emitter::ALU_ADD, X64Emitter::RSP, 8, true);
+            for (int i = 5; i >= 0; i--) a.Pop(saved[i]);
+            a.Ret();
+
+            for (auto& jump : branches) a.Patch(jump.first, labels[jump.second - start]);
+            for (size_t at : exits) a.Patch(at, epilogue);
+            out.swap(a.Code());
+            return true;
+        }
+
+    private:
+        typedef X64Emitter::Reg Reg;
+        const Instruction* program;
+        int programLength;
+        JitLoadHelper load;
+        JitStoreHelper store;
+        X64Emitter a;
+        int regionStart = 0, regionEnd = 0;
+        int8_t home[VM_REGISTER_COUNT];                         // Guest register -> index into HostRegs, or -1 (in the frame)
+        vector<size_t> labels;                                  // Native offset of each instruction in the region
+        vector<pair<size_t, int>> branches;                     // rel32 to patch -> target instruction (inside the region)
+        vector<size_t> exits;                                   // rel32 to patch -> epilogue
+
+        static const int ZF_OFFSET = offsetof(JitFrame, zf), SF_OFFSET = offsetof(JitFrame, sf);
+        static const int OF_OFFSET = offsetof(JitFrame, of), CF_OFFSET = offsetof(JitFrame, cf);
+
+        static int RegOffset(int g) { return (int)(offsetof(JitFrame, regs) + g * sizeof(int32_t)); }
+        Reg Host(int g) const {
+            static const Reg hostRegs[] = { X64Emitter::RBX, X64Emitter::RBP, X64Emitter::R12, X64Emitter::R13, X64Emitter::R14 };
+            return hostRegs[home[g]];
+        }
+
+        void AssignRegisters() {                                // Most referenced guest registers get host registers
+            int uses[VM_REGISTER_COUNT] = {};
+            for (int pc = regionStart; pc < regionEnd; pc++) {
+                const Instruction& ins = program[pc];
+                if (ins.opcode == OP_IDIV) { uses[0]++; uses[1]++; }
+                for (int i = 0; i < ins.operandCount; i++) {
+                    const Operand& op = ins.ops[i];
+                    if (op.kind == OPND_REG) uses[op.value]++;
+                    if (op.kind == OPND_MEM && op.base != NO_REGISTER) uses[op.base]++;
+                    if (op.kind == OPND_MEM && op.index != NO_REGISTER) uses[op.index]++;
+                }
+            }
+            for (int g = 0; g < VM_REGISTER_COUNT; g++) home[g] = -1;
+            for (int slot = 0; slot < 5; slot++) {
+                int best = -1;
+                for (int g = 0; g < VM_REGISTER_COUNT; g++) {
+                    if (home[g] < 0 && uses[g] > 0 && (best < 0 || uses[g] > uses[best])) best = g;
+                }
+                if (best < 0) break;
+                home[best] = (int8_t)slot;
+            }
+        }
+
+        void LoadGuest(Reg dst, int g) {
+            if (home[g] >= 0) a.Mov(dst, Host(g)); else a.Load(dst, X64Emitter::R15, RegOffset(g));
+        }
+        void StoreGuest(int g, Reg src) {
+            if (home[g] >= 0) a.Mov(Host(g), src); else a.Store(X64Emitter::R15, RegOffset(g), src);
+        }
+        void LoadValue(Reg dst, const Operand& op) {            // Register or immediate operand
+            if (op.kind == OPND_REG) LoadGuest(dst, op.value); else a.MovImm(dst, op.value);
+        }
+        void AddGuest(Reg dst, int g) {
+            if (home[g] >= 0) a.Op(X64Emitter::ALU_ADD, dst, Host(g));
+            else a.OpMem(X64Emitter::ALU_ADD, dst, X64Emitter::R15, RegOffset(g));
+        }
+
+        void Address(const Operand& mem) {                      // esi = effective address of an OPND_MEM operand
+            a.MovImm(X64Emitter::RSI, mem.value);
+            if (mem.base != NO_REGISTER) AddGuest(X64Emitter::RSI, mem.base);
+            if (mem.index != NO_REGISTER) AddGuest(X64Emitter::RSI, mem.index);
+        }
+        void CallLoad(const Operand& mem) {                     // eax = guest memory at mem (zero-extended)
+            Address(mem);
+            a.MovImm(X64Emitter::RDX, mem.width);
+            a.Mov64(X64Emitter::RDI, X64Emitter::R15);
+            a.MovImm64(X64Emitter::RAX, (uint64_t)reinterpret_cast<uintptr_t>(load));
+            a.Call(X64Emitter::RAX);
+        }
+        void CallStore(const Operand& mem, const Operand& value) {  // guest memory at mem = value
+            LoadValue(X64Emitter::RDX, value);
+            Address(mem);
+            a.MovImm(X64Emitter::RCX, mem.width);
+            a.Mov64(X64Emitter::RDI, X64Emitter::R15);
+            a.MovImm64(X64Emitter::RAX, (uint64_t)reinterpret_cast<uintptr_t>(store));
+            a.Call(X64Emitter::RAX);
+        }
+
+        void SetFlag(X64Emitter::Cond cc, int flag) { a.SetCC(cc, X64Emitter::R15, flag); }
+        void ClearFlag(int flag) { a.StoreByteImm(X64Emitter::R15, flag, 0); }
+        void StoreFlag(int flag, Reg src) { a.StoreByte(X64Emitter::R15, flag, src); }
+        void SetZeroSign(Reg result) {                          // ZF/SF of a value (MOV, IMUL and IDIV results)
+            a.Op(X64Emitter::ALU_TEST, result, result);
+            SetFlag(X64Emitter::CC_E, ZF_OFFSET);
+            SetFlag(X64Emitter::CC_S, SF_OFFSET);
+        }
+
+        X64Emitter::Cond TestCondition(int cond) {              // Host flags from the frame flags (uses dl); returns the cc that means cond holds
+            typedef X64Emitter E;
+            switch (cond & ~1) {
+                case COND_E:  a.CmpByteImm(E::R15, ZF_OFFSET, 0); break;
+                case COND_B:  a.CmpByteImm(E::R15, CF_OFFSET, 0); break;
+                case COND_S:  a.CmpByteImm(E::R15, SF_OFFSET, 0); break;
+                case COND_O:  a.CmpByteImm(E::R15, OF_OFFSET, 0); break;
+                case COND_L:                                    // SF != OF
+                    a.LoadByte(E::RDX, E::R15, SF_OFFSET);
+                    a.AluByte(E::ALU_CMP, E::RDX, E::R15, OF_OFFSET);
+                    break;
+                case COND_LE:                                   // ZF || SF != OF
+                    a.LoadByte(E::RDX, E::R15, SF_OFFSET);
+                    a.AluByte(E::ALU_XOR, E::RDX, E::R15, OF_OFFSET);
+                    a.AluByte(E::ALU_OR, E::RDX, E::R15, ZF_OFFSET);
+                    break;
+                case COND_BE:                                   // CF || ZF
+                    a.LoadByte(E::RDX, E::R15, CF_OFFSET);
+                    a.AluByte(E::ALU_OR, E::RDX, E::R15, ZF_OFFSET);
+                    break;
+            }
+            return (cond & 1) ? E::CC_E : E::CC_NE;             // Odd conditions are the negations
+        }
+
+        void Exit(int pc) {                                     // Leave the region with eax = pc
+            a.MovImm(X64Emitter::RAX, pc);
+            exits.push_back(a.Jmp());
+        }
+        void Branch(int target) {                               // Unconditional jump to a guest instruction
+            if (target >= regionStart && target < regionEnd) branches.push_back(make_pair(a.Jmp(), target));
+            else Exit(target);
+        }
+        void BranchIf(X64Emitter::Cond cc, int target) {        // Jump to target if cc holds for the host flags
+            if (target >= regionStart && target < regionEnd) {
+                branches.push_back(make_pair(a.Jcc(cc), target));
+            } else {
+                size_t skip = a.Jcc((X64Emitter::Cond)(cc ^ 1));
+                Exit(target);
+                a.Patch(skip, a.Size());
+            }
+        }
+
+        void Emit(int pc, const Instruction& ins) {             // Native code with the semantics of the Execute* handler
+            typedef X64Emitter E;
+            const Operand* ops = ins.ops;
+            switch (ins.opcode) {
+                case OP_NOP:
+                    break;
+                case OP_MOV:
+                    if (ops[0].kind == OPND_MEM) {              // MOV <size> PTR [mem], value: no flags
+                        CallStore(ops[0], ops[1]);
+                        break;
+                    }
+                    if (ops[1].kind == OPND_MEM) CallLoad(ops[1]); else LoadValue(E::RAX, ops[1]);
+                    StoreGuest(ops[0].value, E::RAX);
+                    SetZeroSign(E::RAX);                        // MOV to a register sets ZF and SF
+                    break;
+                case OP_MOVZX:
+                    CallLoad(ops[1]);
+                    StoreGuest(ops[0].value, E::RAX);
+                    break;
+                case OP_ADD:                                    // All four flags as x86 (CF = carry / borrow)
+                case OP_SUB:
+                case OP_CMP:
+                    LoadValue(E::RAX, ops[0]);
+                    LoadValue(E::RCX, ops[1]);
+                    a.Op(ins.opcode == OP_ADD ? E::ALU_ADD : E::ALU_SUB, E::RAX, E::RCX);
+                    if (ins.opcode != OP_CMP) StoreGuest(ops[0].value, E::RAX);
+                    SetFlag(E::CC_E, ZF_OFFSET);
+                    SetFlag(E::CC_S, SF_OFFSET);
+                    SetFlag(E::CC_O, OF_OFFSET);
+                    SetFlag(E::CC_B, CF_OFFSET);
+                    break;
+                case OP_IMUL:                                   // OF = CF = result does not fit in 32 bits
+                    LoadGuest(E::RAX, ops[0].value);
+                    LoadValue(E::RCX, ops[1]);
+                    a.Imul(E::RAX, E::RCX);
+                    StoreGuest(ops[0].value, E::RAX);
+                    a.SetCC(E::CC_O, E::RDX);
+                    SetZeroSign(E::RAX);
+                    StoreFlag(OF_OFFSET, E::RDX);
+                    StoreFlag(CF_OFFSET, E::RDX);
+                    break;
+                case OP_IDIV: {                                 // R0 = (R0 | R1 << 32) / divisor, R1 = remainder
+                    LoadValue(E::RCX, ops[0]);
+                    a.Op(E::ALU_TEST, E::RCX, E::RCX);
+                    size_t nonZero = a.Jcc(E::CC_NE);
+                    a.MovImm(E::RAX, ~pc);                      // Division by zero: the interpreter reports it
+                    exits.push_back(a.Jmp());
+                    a.Patch(nonZero, a.Size());
+                    a.OpImm(E::ALU_CMP, E::RCX, -1);
+                    size_t notMinusOne = a.Jcc(E::CC_NE);
+                    a.MovImm(E::RAX, ~pc);                      // Divisor -1: INT64_MIN / -1 traps, the interpreter faults
+                    exits.push_back(a.Jmp());
+                    a.Patch(notMinusOne, a.Size());
+                    LoadGuest(E::RAX, 0);
+                    a.Movsxd(E::RAX, E::RAX);
+                    LoadGuest(E::RDX, 1);
+                    a.Movsxd(E::RDX, E::RDX);
+                    a.Shl64(E::RDX, 32);
+                    a.Or64(E::RAX, E::RDX);                     // Sign-extended R0 OR'ed with R1 << 32, as ExecuteIdiv
+                    a.Movsxd(E::RCX, E::RCX);
+                    a.Cqo();
+                    a.Idiv64(E::RCX);
+                    StoreGuest(0, E::RAX);
+                    StoreGuest(1, E::RDX);
+                    SetZeroSign(E::RAX);
+                    ClearFlag(OF_OFFSET);
+                    ClearFlag(CF_OFFSET);
+                    break;
+                }
+                case OP_INC:                                    // OF on wrap-around, CF untouched
+                case OP_DEC:
+                    LoadGuest(E::RAX, ops[0].value);
+                    a.OpImm(ins.opcode == OP_INC ? E::ALU_ADD : E::ALU_SUB, E::RAX, 1);
+                    StoreGuest(ops[0].value, E::RAX);
+                    SetFlag(E::CC_E, ZF_OFFSET);
+                    SetFlag(E::CC_S, SF_OFFSET);
+                    SetFlag(E::CC_O, OF_OFFSET);
+                    break;
+                case OP_JMP:
+                    Branch(ops[0].value);
+                    break;
+                default:
+                    if (IsConditionalJump(ins.opcode)) {
+                        BranchIf(TestCondition(ConditionOf(ins.opcode)), ops[0].value);
+                    } else if (IsSetcc(ins.opcode)) {           // reg = 0 / 1, flags untouched
+                        a.MovImm(E::RAX, 0);
+                        a.SetCC(TestCondition(ConditionOf(ins.opcode)), E::RAX);
+                        StoreGuest(ops[0].value, E::RAX);
+                    } else if (IsCmovcc(ins.opcode)) {          // reg = value if the condition holds
+                        LoadGuest(E::RAX, ops[0].value);
+                        LoadValue(E::RCX, ops[1]);
+                        a.Cmov(TestCondition(ConditionOf(ins.opcode)), E::RAX, E::RCX);
+                        StoreGuest(ops[0].value, E::RAX);
+                    }
+                    break;
+            }
+        }
+};
+
+// ========== TRACE LEVELS ==========
+// Diagnostic output (the per-step "[PC=..] Executing:" line, "-> ..." handler notes, flag dumps)
+// is filtered by a runtime trace level. Guest program output (PRINT_STR, WRITE_INT, Crlf,
+// matrix prompts and displays) is not trace: it goes through GuestOutput and is always produced.
+enum TraceLevel {
+    TRACE_OFF,                                                  // Guest output only
+    TRACE_ERRORS,                                               // + runtime errors (bad FREE, division by zero, stack underflow, ...)
+    TRACE_CALLS,                                                // + CALL/RET, HALT and end of program
+    TRACE_FULL,                                                 // + every executed instruction and its effects (default)
+    TRACE_DEBUG                                                 // + memory dumps (bytes stored by READ_STRING)
+};
+
+const char* const TraceLevelNames[] = { "off", "errors", "calls", "full", "debug" };
+
+// VM_TRACE(level) << ...; streams to cout only when the VM's cached trace level is at least
+// level. Below it, the whole statement (including operand formatting) is one skipped branch.
+// TraceStream() flushes pending guest output first so trace and guest text stay in order.
+// The if/else form keeps it safe inside unbraced if statements.
+#define VM_TRACE(level) if (!Tracing(level)) {} else TraceStream()
+
 class VirtualMachine {
 private:
-        unordered_map<string, int> registers;           // Storage for CPU registers (name-value pairs)
+        int32_t regs[VM_REGISTER_COUNT];                // Register file indexed by register number (decoded at load time)
         unordered_map<string, string> stringMemory;     // Storage for named string constants
-        vector<string> programMemory;                   // Stores program instructions as strings
+        vector<string> programMemory;                   // Stores program instructions as strings (source text for tracing)
+        vector<Instruction> code;                       // Decoded program (text loads; empty when running a bytecode image)
+        const Instruction* program = nullptr;           // Code executed by run(): code.data() or straight out of image
+        int programLength = 0;                          // Number of instructions at program
+        ProgramImage image;                             // Loaded bytecode image (mapped read-only where possible)
+        vector<uint32_t> sourceOffsets;                 // Bytecode source section: image offset of each line (no copies)
+        vector<int32_t> codeLines;                      // Text loads: source line index of each instruction
+        const int32_t* lineTable = nullptr;             // Instruction index -> source line (codeLines.data() or into image)
+        vector<string> loadErrors;                      // Errors reported by the last load (undefined labels, bad image)
+        bool superinstructions = true;                  // Fuse common sequences at run time (SetSuperinstructions)
+        vector<uint16_t> dispatchOps;                   // Per-instruction dispatch opcode (see DispatchOps)
+        enum { DISPATCH_FUSED = 1, DISPATCH_JIT = 2 };  // dispatchOps build mode bits
+        int dispatchBuiltFor = -1;                      // dispatchOps build mode, or -1 when stale
+        int fusedCount = 0;                             // Superinstructions in dispatchOps
+        bool jitEnabled = false;                        // Compile hot regions to native code (SetJit)
+        uint32_t jitThreshold = VM_JIT_THRESHOLD;       // Branch-target visits before compiling (compared with jitHotness)
+        vector<uint32_t> jitHotness;                    // Visit count per instruction (branch targets only)
+        vector<JitFunction> jitEntries;                 // Native entry per instruction (region starts only)
+        vector<unique_ptr<ExecutableMemory>> jitCode;   // Compiled regions
+        vector<string> symbolNames;                     // Symbol table: names referenced by PRINT_STR, OFFSET and labels
+        unordered_map<string, int> symbolIds;           // Symbol name -> index in symbolNames
+        vector<ResolvedSymbol> symbols;                 // Symbol id -> string constant / buffer binding
         unordered_map<string, int> labels;              // Maps label names to instruction addresses
         int programCounter;                             // Tracks current instruction position [EIP equivalent]
+        unsigned long long instructionsExecuted = 0;    // Number of dispatched instructions (benchmark statistics)
         bool running;                                   // VM execution state (true=running, false=stopped)
+        int traceLevel;                                 // Cached TraceLevel checked by VM_TRACE
+        GuestOutput guestOut;                           // Buffered guest program output
+        istream* guestIn = &cin;                        // Source of READ_INT/READ_STRING/READ_CHAR/matrix input
+        unique_ptr<istream> ownedInput;                 // Input stream owned by the VM (file or in-memory script)
+        bool batchMode = false;                         // Non-interactive: CLRSC does not wait or clear, input EOF halts
         
-        bool ZF, SF, OF, CF;                            // Status flags: Zero, Sign, Overflow, Carry
-        stack<int> callStack;                           // Stores return addresses for CALL/RET instructions
-        stack<int> dataStack;                           // General purpose stack for data operations
-        unordered_map<int, int> virtualMemory;          // Simulates memory address space (address-value pairs)
-        int nextMemoryAddress = 0x1000;                 // Next available memory address (starts at 0x1000)
+        enum FlagOp : uint8_t { FLAGS_KNOWN, FLAGS_ADD, FLAGS_SUB, FLAGS_INC, FLAGS_DEC, FLAGS_MOV }; // Last flag-setting operation
+        bool ZF, SF, OF, CF;                            // Status flags: Zero, Sign, Overflow, Carry (see FLAGS below)
+        bool DF = false;                                // Direction flag of the string primitives (STD/CLD)
+        uint8_t flagOp = FLAGS_KNOWN;                   // Operation whose operands/result define the flags
+        int32_t flagLeft = 0, flagRight = 0, flagResult = 0; // Its operands and result
+        BoundedStack callStack = BoundedStack(VM_CALL_STACK_DEPTH); // Return addresses for CALL/RET instructions
+        BoundedStack dataStack = BoundedStack(VM_DATA_STACK_DEPTH); // PUSH/POP values (unless the stack is in guest memory)
+        int guestStackBase = 0, guestStackTop = 0;      // Data stack block in guest memory [base, top), 0/0 if host-side
+        string faultMessage;                            // Why the program was stopped by a guest fault (empty if none)
+        vector<uint8_t> stringScratch;                  // Reused host buffer of STRREV/STRCMP/SCASB/CMPSB
+        string inputLine;                               // Reused host buffer of READ_STRING
+        PagedMemory virtualMemory;                      // Simulates memory address space (paged, allocated on first touch)
+        HeapAllocator heap = HeapAllocator(0x1000);     // ALLOC/FREE allocator (heap starts at 0x1000)
         unordered_map<string, int> matrixPointers;      // Stores matrix names and base memory addresses
         int matrixSize;                                 // Size dimension for allocated matrices
         bool matrixAllocated;                           // Tracks if matrix memory is currently allocated
@@ -33,13 +1412,15 @@ private:
         bool usePrev;                                   // Flag to use previous result
         
         // String buffers
-        unordered_map<string, int> stringBuffers;       // Maps buffer names to memory addresses
-        unordered_map<string, int> stringVariables;     // For DWORD variables (addresses, lengths)
+        unordered_map<string, int> stringBuffers;       // Maps buffer names to memory addresses (allocated on declaration)
+        vector<pair<string, int>> bufferDeclarations;   // BUFFER name, size of the loaded program, in source order
+        int stringVariables[4];                         // For DWORD variables (addresses, lengths), indexed from VAR_STRING1_ADDR
                
     public:
-        VirtualMachine() {                               // Constructor - initializes virtual machine state
-            for (int i = 0; i < 6; i++) {                // Loop to initialize 6 general purpose registers
-                registers["R" + to_string(i)] = 0;       // Initialize register R0-R5 with value 0  [R0= EAX, R1 = EBX, R2 = ECX, R3 = EDX, R4 = ESI, R5 = EDI]
+        explicit VirtualMachine(TraceLevel level = TRACE_FULL) { // Constructor - initializes virtual machine state
+            traceLevel = level;                          // Set first so construction-time messages are filtered too
+            for (int i = 0; i < VM_REGISTER_COUNT; i++) { // Loop to initialize the general purpose registers
+                regs[i] = 0;                             // Initialize register with value 0  [R0= EAX, R1 = EBX, R2 = ECX, R3 = EDX, R4 = ESI, R5 = EDI]
             }
             programCounter = 0;                          // Set program counter to start at first instruction [PC = EIP]
             running = true;                              // Set VM execution state to running
@@ -62,31 +1443,11 @@ private:
             firstNum = 0;                                // First operand
             secondNum = 0;                               // Second operand
             remainder = 0;                               // Remainder
-            
-            // Initialize string buffers (allocate memory addresses for them)
-            InitializeStringBuffers();
-        }
-        
-        void InitializeStringBuffers() {
-            // Allocate memory for string buffers (100 bytes each, 200 for result)
-            stringBuffers["string1"] = AllocateVirtualMemory(100);           // 100 bytes
-            stringBuffers["string2"] = AllocateVirtualMemory(100);           // 100 bytes
-            stringBuffers["resultString"] = AllocateVirtualMemory(200);      // 200 bytes for concatenation
-            stringBuffers["reversedString"] = AllocateVirtualMemory(100);    // 100 bytes
-            stringBuffers["copiedString"] = AllocateVirtualMemory(100);      // 100 bytes
-            
-            // Initialize string variables (pointers and lengths)
-            stringVariables["string1Addr"] = 0;
-            stringVariables["string2Addr"] = 0;
-            stringVariables["string1Length"] = 0;
-            stringVariables["string2Length"] = 0;
-            
-            cout << "=== String Buffers Initialized ===" << endl;
-            cout << "string1 at address: 0x" << hex << stringBuffers["string1"] << dec << endl;
-            cout << "string2 at address: 0x" << hex << stringBuffers["string2"] << dec << endl;
-            cout << "resultString at address: 0x" << hex << stringBuffers["resultString"] << dec << endl;
-            cout << "reversedString at address: 0x" << hex << stringBuffers["reversedString"] << dec << endl;
-            cout << "copiedString at address: 0x" << hex << stringBuffers["copiedString"] << dec << endl;
+
+            // Initialize string variables (pointers and lengths); the buffers themselves come from BUFFER directives
+            for (int i = 0; i < 4; i++) {
+                stringVariables[i] = 0;                  // string1Addr, string2Addr, string1Length, string2Length
+            }
         }
         
         void InitializeStringMemory() {                                 // Method to set up predefined string messages
@@ -142,884 +1503,2288 @@ private:
             stringMemory["ClearCharacter"] = "Z";
         }
 
-        int AllocateVirtualMemory(int size) {                       // Allocates contiguous block in virtual memory
-            int address = nextMemoryAddress;                        // Get next available memory address
-            for (int i = 0; i < size; i++) {                        // Loop through each element to allocate
-                virtualMemory[address + i] = 0;                     // Initialize memory location to zero (byte-aligned)
+        int AllocateVirtualMemory(int size) {                       // Allocates contiguous block in virtual memory (0 if it cannot)
+            int address = heap.Allocate(size);                      // Reuses a freed range when one fits
+            if (address == 0) {
+                VM_TRACE(TRACE_ERRORS) << "  -> ERROR: cannot allocate " << (uint32_t)size << " bytes" << endl;
+                return 0;
+            }
+            virtualMemory.Fill(address, size, 0);                   // Initialize memory locations to zero (ranges may be reused)
+            VM_TRACE(TRACE_FULL) << "  -> Allocated " << size << " bytes at address 0x" << hex << address << dec << endl;
+            return address;                                         // Return base address of allocated block
+        }
+        bool FreeVirtualMemory(int address) {                           // Deallocates the whole block starting at address
+            if (heap.Free(address) == 0) {                              // Not the base of a live block
+                VM_TRACE(TRACE_ERRORS) << "  -> ERROR: FREE of unallocated address 0x" << hex << address << dec << endl;
+                return false;
+            }
+            VM_TRACE(TRACE_FULL) << "  -> Freed memory at address 0x" << hex << address << dec << endl;
+            return true;
+        }
+        HeapStats GetHeapStats() const { return heap.Stats(); }         // Live/peak/free bytes and fragmentation
+
+        int ReadVirtualMemory(int address, int width = DWORD_SIZE) {    // Reads a BYTE/WORD/DWORD from virtual memory (zero-extended)
+            return (int)virtualMemory.Read(address, width);             // Return value stored at memory address (0 if unmapped)
+        }
+
+        void WriteVirtualMemory(int address, int value, int width = DWORD_SIZE) { // Writes the low 'width' bytes of value
+            virtualMemory.Write(address, (uint32_t)value, width);       // Store little-endian in the page(s) that hold address
+        }
+        
+        // Named buffers are allocated only when declared: by a BUFFER directive when its program is
+        // loaded, or by the host through DeclareStringBuffer(). They stay allocated for the life of the VM.
+        static const int MAX_BUFFER_SIZE = 1 << 24;                     // Largest BUFFER (16 MiB)
+
+        int DeclareStringBuffer(const string& name, int size) {         // Named guest buffer of at least size bytes; returns its address
+            auto it = stringBuffers.find(name);
+            if (it != stringBuffers.end()) {
+                if (heap.BlockSize(it->second) >= size) return it->second; // Already declared (e.g. by an earlier load) and big enough
+                FreeVirtualMemory(it->second);
+            }
+            int address = AllocateVirtualMemory(size);
+            stringBuffers[name] = address;
+            auto id = symbolIds.find(name);                             // Rebind operands of the loaded program that name it
+            if (id != symbolIds.end() && id->second < (int)symbols.size()) {
+                symbols[id->second].bufferAddress = address;
+                symbols[id->second].isBuffer = true;
+            }
+            VM_TRACE(TRACE_FULL) << "  -> String buffer '" << name << "' at address 0x" << hex << address << dec << endl;
+            return address;
+        }
+
+        void AllocateDeclaredBuffers() {                                // BUFFER directives of the program just loaded
+            for (const auto& buffer : bufferDeclarations) DeclareStringBuffer(buffer.first, buffer.second);
+        }
+
+        // Helper to get address of string buffer by name
+        int GetStringBufferAddress(const string& bufferName) {
+            if (stringBuffers.find(bufferName) != stringBuffers.end()) {
+                return stringBuffers[bufferName];
+            }
+            VM_TRACE(TRACE_ERRORS) << "  -> ERROR: String buffer '" << bufferName << "' not found!" << endl;
+            return 0;
+        }
+
+        int GetMatrixElementAddress(int baseAddress, int row, int col, int size) {
+            return baseAddress + (row * size + col) * 4;                // Calculate address: base + (row*size + col) * 4 bytes
+        }
+        
+        // Every loader returns false (and leaves nothing runnable) if the program cannot be linked;
+        // LoadErrors() lists the reasons.
+        bool LoadProgram(const string& filename) {                      // Loads assembly program from file into memory
+            if (IsBytecodeFile(filename)) {                             // Assembled image: mapped and run in place, not parsed
+                return LoadBytecode(filename);
+            }
+            ifstream file(filename);                                    // Open input file stream for reading
+            if (!file) {
+                BeginLoad();
+                LoadError("cannot open '" + filename + "'");
+                return false;
+            }
+            return LoadProgramFromStream(file);
+        }
+
+        bool LoadProgramFromString(const string& source) {              // Loads a whole program held in memory (lines separated by '\n')
+            istringstream stream(source);
+            return LoadProgramFromStream(stream);
+        }
+
+        bool LoadProgramFromLines(const vector<string>& lines) {        // One source line per element
+            BeginLoad();
+            for (const string& line : lines) AddSourceLine(line);
+            return FinishLoad();
+        }
+
+        bool LoadProgramFromLines(const char* const lines[], size_t count) { // Static line table (e.g. the built-in menu program)
+            BeginLoad();
+            for (size_t i = 0; i < count; i++) AddSourceLine(lines[i]);
+            return FinishLoad();
+        }
+
+        bool LoadProgramFromStream(istream& in) {
+            string line;                                                // Store each line read from the stream
+            BeginLoad();
+            while (getline(in, line)) {                                 // Read line by line until EOF
+                AddSourceLine(line);
+            }
+            return FinishLoad();
+        }
+
+        void BeginLoad() {
+            programMemory.clear();
+            codeLines.clear();
+            labels.clear();
+            bufferDeclarations.clear();
+            loadErrors.clear();
+            program = nullptr;                                          // Nothing is runnable until a load succeeds
+            programLength = 0;
+            VM_TRACE(TRACE_FULL) << "=== LOADING PROGRAM ===" << endl;                  // Print loading header
+        }
+
+        void AddSourceLine(string line) {                               // Clean one source line and record labels
+            size_t commentPos = line.find(';');                         // Find position of comment delimiter
+            if (commentPos != string::npos) {                           // Check if comment exists in line
+                line = line.substr(0, commentPos);                      // Remove comment portion from line
+            }
+            line.erase(0, line.find_first_not_of(" \t\r"));            // Remove leading whitespace and tabs
+            line.erase(line.find_last_not_of(" \t\r") + 1);            // Remove trailing whitespace, tabs and CR
+
+            if (!line.empty()) {                                        // Check if line is not empty after cleaning
+                int lineNum = (int)programMemory.size();                // Index of this source line
+                VM_TRACE(TRACE_FULL) << "Line " << lineNum << ": " << line << endl; // Print processed line
+
+                if (line.back() == ':') {                               // Label definition: not an instruction
+                    string label = line.substr(0, line.length() - 1);   // Extract label name without colon
+                    labels[label] = (int)codeLines.size();              // Label points at the next real instruction
+                    VM_TRACE(TRACE_FULL) << "  -> LABEL FOUND: '" << label << "' at position " << codeLines.size() << endl;
+                } else if (line.compare(0, 7, "BUFFER ") == 0) {        // Data directive: not an instruction either
+                    AddBufferDirective(lineNum, line);
+                } else {
+                    codeLines.push_back(lineNum);                       // Instruction index -> source line
+                }
+                programMemory.push_back(line);                          // Keep every line for tracing
+            }
+        }
+
+        void AddBufferDirective(int lineNum, const string& line) {      // "BUFFER name, size": allocated once the program links
+            vector<string> tokens = Tokenize(line);
+            int size = 0;
+            if (tokens.size() != 3 || IsRegister(tokens[1]) || !ParseImmediate(tokens[2], size) || size <= 0 || size > MAX_BUFFER_SIZE) {
+                LoadError("line " + to_string(lineNum) + ": expected 'BUFFER name, size' with 1.." + to_string(MAX_BUFFER_SIZE) + " bytes in '" + line + "'");
+                return;
+            }
+            for (const auto& buffer : bufferDeclarations) {
+                if (buffer.first == tokens[1]) {
+                    LoadError("line " + to_string(lineNum) + ": buffer '" + tokens[1] + "' is already declared");
+                    return;
+                }
+            }
+            bufferDeclarations.push_back(make_pair(tokens[1], size));
+        }
+
+        bool FinishLoad() {
+            code.clear();                                               // Compile every instruction line once into decoded form
+            code.reserve(codeLines.size());
+            for (int32_t line : codeLines) {
+                code.push_back(DecodeInstruction(programMemory[line]));
+            }
+            image.Release();                                            // Drop any previously loaded bytecode image
+            sourceOffsets.clear();
+            if (!LinkProgram()) {                                       // Resolve jump targets and symbol bindings
+                VM_TRACE(TRACE_ERRORS) << "=== LOAD FAILED: " << loadErrors.size() << " error(s) ===" << endl;
+                return false;
+            }
+            AllocateDeclaredBuffers();                                  // Only now: a failed load allocates nothing
+            program = code.data();
+            programLength = (int)code.size();
+            lineTable = codeLines.data();
+            dispatchBuiltFor = -1;
+
+            VM_TRACE(TRACE_FULL) << "\n=== PROGRAM LOADED ===" << endl;                 // Print loading completion header
+            VM_TRACE(TRACE_FULL) << "Total instructions: " << code.size() << " (" << programMemory.size() << " source lines)" << endl; // Display instruction count
+            VM_TRACE(TRACE_FULL) << "Labels found: " << labels.size() << endl;          // Display number of labels found
+            for (auto& label : labels) {                                // Iterate through all labels in map
+                VM_TRACE(TRACE_FULL) << "  " << label.first << " -> line " << LineOf(label.second) << endl; // Print label mapping
+            }
+            VM_TRACE(TRACE_FULL) << "======================\n" << endl;                 // Print section footer
+            return true;
+        }
+
+        // ========== BYTECODE ==========
+        vector<uint8_t> BuildBytecodeImage(bool includeSource = true) const { // Serialize the loaded program (see BytecodeHeader)
+            vector<uint8_t> image(sizeof(BytecodeHeader));
+            BytecodeHeader header = {};
+            memcpy(header.magic, BYTECODE_MAGIC, sizeof(header.magic));
+            header.byteOrder = BYTECODE_BYTE_ORDER;
+            header.version = VM_BYTECODE_VERSION;
+            header.instructionSize = sizeof(Instruction);
+            header.opcodeCount = OP_COUNT;
+            header.registerCount = VM_REGISTER_COUNT;
+
+            header.codeOffset = (uint32_t)image.size();
+            header.codeCount = (uint32_t)programLength;
+            const uint8_t* codeBytes = (const uint8_t*)program;
+            image.insert(image.end(), codeBytes, codeBytes + programLength * sizeof(Instruction));
+
+            header.lineOffset = (uint32_t)image.size();
+            bool withLines = includeSource && SourceLineCount() != 0;
+            for (int i = 0; withLines && i < programLength; i++) {
+                AppendImageU32(image, (uint32_t)lineTable[i]);
+            }
+
+            header.symbolOffset = (uint32_t)image.size();
+            header.symbolCount = (uint32_t)symbolNames.size();
+            for (const string& name : symbolNames) {
+                AppendImageString(image, name);
+                auto text = stringMemory.find(name);
+                if (text != stringMemory.end()) {
+                    AppendImageString(image, text->second);     // String constants travel with the program
+                } else {
+                    AppendImageU32(image, BYTECODE_NO_TEXT);
+                }
+            }
+
+            header.labelOffset = (uint32_t)image.size();
+            header.labelCount = (uint32_t)labels.size();
+            for (const auto& label : labels) {
+                AppendImageString(image, label.first);
+                AppendImageU32(image, (uint32_t)label.second);
+            }
+
+            header.bufferOffset = (uint32_t)image.size();
+            header.bufferCount = (uint32_t)bufferDeclarations.size();
+            for (const auto& buffer : bufferDeclarations) {
+                AppendImageString(image, buffer.first);
+                AppendImageU32(image, (uint32_t)buffer.second);
+            }
+
+            header.sourceOffset = (uint32_t)image.size();
+            header.sourceCount = withLines ? (uint32_t)SourceLineCount() : 0;
+            for (uint32_t i = 0; i < header.sourceCount; i++) {
+                AppendImageString(image, SourceLine(i));
+            }
+
+            header.imageSize = (uint32_t)image.size();
+            memcpy(image.data(), &header, sizeof(header));
+            return image;
+        }
+
+        bool SaveBytecode(const string& filename, bool includeSource = true) const {
+            vector<uint8_t> image = BuildBytecodeImage(includeSource);
+            ofstream file(filename, ios::out | ios::trunc | ios::binary);
+            file.write((const char*)image.data(), image.size());
+            return (bool)file;
+        }
+
+        bool LoadBytecode(const string& filename) {                     // Map an assembled .vmbc file and run straight out of it
+            ProgramImage candidate;
+            loadErrors.clear();
+            if (!candidate.Map(filename)) {
+                LoadError("cannot open bytecode file '" + filename + "'");
+                DropProgram();
+                return false;
+            }
+            if (InstallImage(candidate)) return true;
+            DropProgram();                                              // Like a failed source load: the previous program is gone too
+            return false;
+        }
+
+        bool LoadBytecodeImage(const uint8_t* data, size_t size) {      // Load an image held in memory (copied once)
+            ProgramImage candidate;
+            loadErrors.clear();
+            candidate.Assign(data, size);
+            if (InstallImage(candidate)) return true;
+            DropProgram();
+            return false;
+        }
+
+        void DropProgram() {                                            // Leave nothing runnable (after a failed load)
+            program = nullptr;
+            programLength = 0;
+            lineTable = nullptr;
+            dispatchBuiltFor = -1;
+            image.Release();
+            sourceOffsets.clear();
+        }
+
+        bool InstallImage(ProgramImage& candidate) {                    // Validate an image fully, then take it over; on error the VM's state is untouched
+            const uint8_t* data = candidate.Data();
+            size_t size = candidate.Size();
+            BytecodeHeader header;
+            if (size < sizeof(header)) return BytecodeError("image is truncated");
+            memcpy(&header, data, sizeof(header));
+            if (memcmp(header.magic, BYTECODE_MAGIC, sizeof(header.magic)) != 0) return BytecodeError("not a bytecode image");
+            if (header.byteOrder != BYTECODE_BYTE_ORDER) return BytecodeError("image was built for a different byte order");
+            if (header.version != VM_BYTECODE_VERSION || header.instructionSize != sizeof(Instruction) || header.opcodeCount != OP_COUNT) {
+                return BytecodeError("image was built for a different VM version");
+            }
+            if (header.registerCount > VM_REGISTER_COUNT) return BytecodeError("image uses more registers than this VM has");
+            if (header.imageSize != size || header.codeOffset > size || header.codeCount > (size - header.codeOffset) / sizeof(Instruction)) {
+                return BytecodeError("image is truncated");
+            }
+            if (header.codeOffset % alignof(Instruction) != 0) return BytecodeError("code section is misaligned");
+
+            vector<string> names;
+            vector<pair<string, uint32_t>> constants;           // Symbol id -> text (BYTECODE_NO_TEXT entries skipped)
+            unordered_map<string, int> labelTable;
+            vector<pair<string, int>> buffers;
+            vector<uint32_t> lineOffsets;
+            size_t pos = header.symbolOffset;
+            for (uint32_t i = 0; i < header.symbolCount; i++) {
+                string name, text;
+                uint32_t textLength;
+                if (!ReadImageString(data, size, pos, name) || !PeekImageU32(data, size, pos, textLength)) return BytecodeError("bad symbol table");
+                if (textLength == BYTECODE_NO_TEXT) {
+                    pos += sizeof(uint32_t);
+                } else {
+                    if (!ReadImageString(data, size, pos, text)) return BytecodeError("bad symbol table");
+                    constants.push_back(make_pair(text, i));
+                }
+                names.push_back(name);
+            }
+            pos = header.labelOffset;
+            for (uint32_t i = 0; i < header.labelCount; i++) {
+                string name;
+                uint32_t target;
+                if (!ReadImageString(data, size, pos, name) || !PeekImageU32(data, size, pos, target) || target > header.codeCount) {
+                    return BytecodeError("bad label table");
+                }
+                pos += sizeof(uint32_t);
+                labelTable[name] = (int)target;
+            }
+            pos = header.bufferOffset;
+            for (uint32_t i = 0; i < header.bufferCount; i++) {
+                string name;
+                uint32_t bytes;
+                if (!ReadImageString(data, size, pos, name) || !PeekImageU32(data, size, pos, bytes) || bytes == 0 || bytes > (uint32_t)MAX_BUFFER_SIZE) {
+                    return BytecodeError("bad buffer table");
+                }
+                pos += sizeof(uint32_t);
+                buffers.push_back(make_pair(name, (int)bytes));
+            }
+            pos = header.sourceOffset;
+            lineOffsets.reserve(header.sourceCount);
+            for (uint32_t i = 0; i < header.sourceCount; i++) {  // Only record where each line is; text stays in the image
+                uint32_t length;
+                if (!PeekImageU32(data, size, pos, length) || size - pos - sizeof(length) < length) return BytecodeError("bad source section");
+                lineOffsets.push_back((uint32_t)pos);
+                pos += sizeof(length) + length;
+            }
+
+            const Instruction* mappedCode = (const Instruction*)(data + header.codeOffset);
+            for (uint32_t i = 0; i < header.codeCount; i++) {  // Reject anything the handlers could index out of range with
+                if (!ValidInstruction(mappedCode[i], header.codeCount, (uint32_t)names.size())) {
+                    return BytecodeError("bad instruction in code section");
+                }
+            }
+            const int32_t* mappedLines = nullptr;
+            if (header.sourceCount != 0) {                      // Line table: one source line index per instruction
+                if (header.lineOffset % alignof(int32_t) != 0 || header.lineOffset > size || header.codeCount > (size - header.lineOffset) / sizeof(int32_t)) {
+                    return BytecodeError("bad line table");
+                }
+                mappedLines = (const int32_t*)(data + header.lineOffset);
+                for (uint32_t i = 0; i < header.codeCount; i++) {
+                    if (mappedLines[i] < 0 || (uint32_t)mappedLines[i] >= header.sourceCount) return BytecodeError("bad line table");
+                }
+            }
+
+            // Image is valid: execute straight out of it
+            image.Swap(candidate);
+            program = mappedCode;
+            programLength = (int)header.codeCount;
+            lineTable = mappedLines;
+            dispatchBuiltFor = -1;
+            code.clear();
+            code.shrink_to_fit();
+            codeLines.clear();
+            programMemory.clear();
+            sourceOffsets.swap(lineOffsets);
+            symbolNames.swap(names);
+            symbolIds.clear();
+            for (size_t i = 0; i < symbolNames.size(); i++) symbolIds[symbolNames[i]] = (int)i;
+            for (const auto& constant : constants) stringMemory[symbolNames[constant.second]] = constant.first;
+            labels.swap(labelTable);
+            bufferDeclarations.swap(buffers);
+            ResolveSymbols();                                   // Bind names to this VM's constants and buffers
+            AllocateDeclaredBuffers();
+            VM_TRACE(TRACE_FULL) << "=== BYTECODE LOADED: " << programLength << " instructions, " << symbolNames.size() << " symbols, "
+                                 << labels.size() << " labels, " << bufferDeclarations.size() << " buffers" << (image.IsMapped() ? " (mapped)" : "") << " ===" << endl;
+            return true;
+        }
+
+        size_t SourceLineCount() const {                                // Source lines available for tracing
+            return programMemory.empty() ? sourceOffsets.size() : programMemory.size();
+        }
+
+        string SourceLine(size_t index) const {                         // Text of source line index (from the loader or the image)
+            if (!programMemory.empty()) return programMemory[index];
+            uint32_t length;
+            memcpy(&length, image.Data() + sourceOffsets[index], sizeof(length));
+            return string((const char*)image.Data() + sourceOffsets[index] + sizeof(length), length);
+        }
+
+        int LineOf(int index) const {                                   // Source line of the instruction at index (for trace messages)
+            if (lineTable == nullptr || index < 0 || index >= programLength) return index;
+            return lineTable[index];
+        }
+
+        string SourceText(int index) {                                  // Trace text of the instruction at index
+            if (SourceLineCount() != 0) return SourceLine(lineTable[index]);
+            return DisassembleInstruction(program[index]);              // Stripped image
+        }
+
+        static bool IsBytecodeFile(const string& filename) {            // True if the file starts with the bytecode magic
+            ifstream file(filename, ios::in | ios::binary);
+            char magic[4] = {};
+            file.read(magic, sizeof(magic));
+            return file && memcmp(magic, BYTECODE_MAGIC, sizeof(magic)) == 0;
+        }
+
+        static string RegisterListText(uint32_t mask) {                 // "R0, R1, R5" for a PUSHM/POPM mask
+            string text;
+            for (int r = 0; r < VM_REGISTER_COUNT && r < 32; r++) {
+                if (!(mask & (1u << r))) continue;
+                if (!text.empty()) text += ", ";
+                text += "R" + to_string(r);
+            }
+            return text;
+        }
+
+        string DisassembleInstruction(const Instruction& ins) {         // Text form of a decoded instruction
+            string text = OpcodeNames[ins.opcode];
+            if (IsStringPrimitive(ins.opcode)) {                        // Only operand: the repeat prefix
+                return (ins.operandCount > 0) ? string(RepPrefixNames[ins.ops[0].value & 3]) + " " + text : text;
+            }
+            for (int i = 0; i < ins.operandCount; i++) {
+                text += (i == 0 ? " " : ", ");
+                if (ins.ops[i].kind == OPND_SYMBOL && ins.opcode == OP_MOV) text += "OFFSET ";
+                if (ins.opcode == OP_PUSHM || ins.opcode == OP_POPM) text += RegisterListText((uint32_t)ins.ops[i].value);
+                else text += OperandText(ins.ops[i]);
+            }
+            return text;
+        }
+
+        bool ValidInstruction(const Instruction& ins, uint32_t codeCount, uint32_t symbolCount) const { // Safe for the handlers to execute
+            if (ins.opcode >= OP_COUNT || ins.operandCount > MAX_OPERANDS) return false;
+            if (!MatchesSignature(ins)) return false;                   // Handlers read operands by position and kind without checking
+            for (int i = ins.operandCount; i < MAX_OPERANDS; i++) {
+                if (ins.ops[i].kind != OPND_NONE) return false;         // DecodeInstruction leaves unused slots empty
+            }
+            if (IsStringPrimitive(ins.opcode) && ins.operandCount > 0 && (ins.ops[0].value < REP_ALWAYS || ins.ops[0].value > REP_WHILE_NOT_EQUAL)) {
+                return false;                                           // Not a repeat prefix
+            }
+            if (ins.opcode == OP_PUSHM || ins.opcode == OP_POPM) {      // RegisterNumber bounds the text form; PushRegisters skips
+                uint32_t mask = (uint32_t)ins.ops[0].value;             // bits past the register file silently
+                if (mask == 0 || (VM_REGISTER_COUNT < 32 && (mask >> (VM_REGISTER_COUNT & 31)) != 0)) return false;
+            }
+            for (int i = 0; i < ins.operandCount; i++) {
+                const Operand& op = ins.ops[i];
+                switch (op.kind) {
+                    case OPND_REG:    if (op.value < 0 || op.value >= VM_REGISTER_COUNT) return false; break;
+                    case OPND_VAR:    if (op.value < 0 || op.value >= VAR_COUNT) return false; break;
+                    case OPND_SYMBOL: if (op.value < 0 || (uint32_t)op.value >= symbolCount) return false; break;
+                    case OPND_LABEL:
+                        if (op.aux < 0 || (uint32_t)op.aux >= symbolCount || op.value < 0 || op.value > (int32_t)codeCount) return false; // == codeCount: label at the very end
+                        break;
+                    case OPND_MEM:
+                        if ((op.base != NO_REGISTER && op.base >= VM_REGISTER_COUNT) || (op.index != NO_REGISTER && op.index >= VM_REGISTER_COUNT)) return false;
+                        if (op.width != BYTE_SIZE && op.width != WORD_SIZE && op.width != DWORD_SIZE) return false;
+                        break;
+                    case OPND_IMM:
+                    case OPND_NONE:   break;
+                    default:          return false;
+                }
+            }
+            return true;
+        }
+
+        bool BytecodeError(const char* message) {
+            LoadError(string("bytecode ") + message);
+            return false;
+        }
+
+        static void AppendImageU32(vector<uint8_t>& image, uint32_t value) {
+            const uint8_t* bytes = (const uint8_t*)&value;
+            image.insert(image.end(), bytes, bytes + sizeof(value));
+        }
+
+        static void AppendImageString(vector<uint8_t>& image, const string& text) {
+            AppendImageU32(image, (uint32_t)text.size());
+            image.insert(image.end(), text.begin(), text.end());
+        }
+
+        static bool PeekImageU32(const uint8_t* data, size_t size, size_t pos, uint32_t& value) {
+            if (pos > size || size - pos < sizeof(value)) return false;
+            memcpy(&value, data + pos, sizeof(value));
+            return true;
+        }
+
+        static bool ReadImageString(const uint8_t* data, size_t size, size_t& pos, string& text) {
+            uint32_t length;
+            if (!PeekImageU32(data, size, pos, length) || size - pos - sizeof(length) < length) return false;
+            text.assign((const char*)data + pos + sizeof(length), length);
+            pos += sizeof(length) + length;
+            return true;
+        }
+
+        // ========== INSTRUCTION DECODER ==========
+        // Operand shapes DecodeInstruction produces for each opcode, one letter per operand slot,
+        // alternatives separated by '|' (an empty alternative: no operands). Bytecode images are
+        // checked against them. Keep in step with the decoder's switch below.
+        //   R register   I immediate   V register, variable or immediate   W register or immediate
+        //   A variable   M memory      S symbol   T register or symbol (string)   L label
+        static const char* OperandSignature(int opcode) {
+            switch (opcode) {
+                case OP_PUSH: case OP_IDIV:                         return "V";
+                case OP_POP: case OP_INC: case OP_DEC:
+                case OP_READ_INT: case OP_READ_STRING: case OP_WRITE_INT: return "R";
+                case OP_ALLOC:                                      return "RR";
+                case OP_FREE:                                       return "R|RR";
+                case OP_GET_ELEMENT_ADDR:                           return "RRRRR";
+                case OP_STORE:                                      return "MW";
+                case OP_LOAD: case OP_MOVZX:                        return "RM";
+                case OP_PUSHM: case OP_POPM:                        return "I";
+                case OP_STRLEN:                                     return "T";
+                case OP_STRCPY: case OP_STRCAT: case OP_STRCMP: case OP_STRREV: return "TT";
+                case OP_PRINT_STR:                                  return "S";
+                case OP_ADD: case OP_SUB: case OP_IMUL:             return "RV";
+                case OP_MOV:                                        return "RS|RM|RV|AV|MW";
+                case OP_CMP:                                        return "VV";
+                case OP_JMP: case OP_CALL:                          return "L";
+                default:
+                    if (IsConditionalJump(opcode)) return "L";
+                    if (IsSetcc(opcode)) return "R";
+                    if (IsCmovcc(opcode)) return "RV";
+                    if (IsStringPrimitive(opcode)) return "|I";  // Optional repeat prefix
+                    return "";
+            }
+        }
+
+        static bool OperandMatches(char shape, const Operand& op) {
+            switch (shape) {
+                case 'R': return op.kind == OPND_REG;
+                case 'I': return op.kind == OPND_IMM;
+                case 'V': return op.kind == OPND_REG || op.kind == OPND_VAR || op.kind == OPND_IMM;
+                case 'W': return op.kind == OPND_REG || op.kind == OPND_IMM;
+                case 'A': return op.kind == OPND_VAR;
+                case 'M': return op.kind == OPND_MEM;
+                case 'S': return op.kind == OPND_SYMBOL;
+                case 'T': return op.kind == OPND_REG || op.kind == OPND_SYMBOL;
+                case 'L': return op.kind == OPND_LABEL;
+                default:  return false;
+            }
+        }
+
+        static bool MatchesSignature(const Instruction& ins) {          // Operand count and kinds form one of the opcode's shapes
+            const char* shape = OperandSignature(ins.opcode);
+            for (;;) {
+                int count = 0;
+                bool match = true;
+                for (; *shape != '\0' && *shape != '|'; shape++, count++) {
+                    match = match && count < ins.operandCount && OperandMatches(*shape, ins.ops[count]);
+                }
+                if (match && count == ins.operandCount) return true;
+                if (*shape == '\0') return false;
+                shape++;                                                // Next alternative
+            }
+        }
+
+        Instruction DecodeInstruction(const string& line) {             // Compile one source line (not a label) into an Instruction
+            Instruction ins = {};                                       // Zero-initialised instruction (OP_NOP, no operands)
+            vector<string> tokens = Tokenize(line);                     // Split instruction into tokens (opcode, operands)
+            if (tokens.empty()) return ins;
+
+            int prefix = ParseRepPrefix(tokens[0]);                     // "REP MOVSB": the primitive carries the prefix
+            if (prefix != REP_NONE && tokens.size() > 1) tokens.erase(tokens.begin());
+            string opcode = tokens[0];                                  // Extract instruction mnemonic (first token)
+
+            int op = LookupOpcode(opcode);                              // Map mnemonic to opcode
+            if (op < 0) return ins;                                     // Unknown mnemonics execute as no-ops
+            ins.opcode = (uint16_t)op;
+
+            bool ok = prefix == REP_NONE || IsStringPrimitive(ins.opcode); // Set to false if the operands are malformed
+            if (ok && prefix != REP_NONE) ins.ops[ins.operandCount++] = MakeOperand(OPND_IMM, prefix);
+            switch (ins.opcode) {
+                case OP_PUSH:                                           // PUSH reg|var|imm
+                    ok = tokens.size() > 1 && AddValueOperand(ins, StripColon(tokens[1]));
+                    break;
+                case OP_POP:                                            // POP reg
+                case OP_INC:                                            // INC reg
+                    ok = tokens.size() > 1 && AddRegisterOperand(ins, StripColon(tokens[1]));
+                    break;
+                case OP_DEC:                                            // DEC reg
+                case OP_READ_INT:                                       // READ_INT reg
+                case OP_READ_STRING:                                    // READ_STRING reg
+                case OP_WRITE_INT:                                      // WRITE_INT reg
+                    ok = tokens.size() > 1 && AddRegisterOperand(ins, tokens[1]);
+                    break;
+                case OP_ALLOC:                                          // ALLOC sizeReg, destReg
+                    ok = tokens.size() > 2 && AddRegisterOperand(ins, tokens[1]) && AddRegisterOperand(ins, tokens[2]);
+                    break;
+                case OP_FREE:                                           // FREE addrReg [, sizeReg] (size is optional and ignored)
+                    ok = tokens.size() > 1 && AddRegisterOperand(ins, tokens[1]);
+                    if (ok && tokens.size() > 2) ok = AddRegisterOperand(ins, tokens[2]);
+                    break;
+                case OP_GET_ELEMENT_ADDR:                               // GET_ELEMENT_ADDR dest, base, row, col, size
+                    ok = tokens.size() > 5;
+                    for (int i = 1; ok && i <= 5; i++) {
+                        ok = AddRegisterOperand(ins, tokens[i]);
+                    }
+                    break;
+                case OP_STORE:                                          // STORE [addr]|reg|<size> PTR [mem], reg|imm
+                    if (tokens.size() > 4 && PtrWidth(tokens[1]) && tokens[2] == "PTR") {
+                        ok = AddMemoryOperand(ins, tokens, 3, PtrWidth(tokens[1])) && AddValueOperand(ins, tokens.back(), false);
+                    } else {
+                        ok = tokens.size() > 2 && AddAddressOperand(ins, tokens[1]) && AddValueOperand(ins, tokens[2], false);
+                    }
+                    break;
+                case OP_LOAD:                                           // LOAD reg, [addr]|reg|<size> PTR [mem]
+                    if (tokens.size() > 4 && PtrWidth(tokens[2]) && tokens[3] == "PTR") {
+                        ok = AddRegisterOperand(ins, tokens[1]) && AddMemoryOperand(ins, tokens, 4, PtrWidth(tokens[2]));
+                    } else {
+                        ok = tokens.size() > 2 && AddRegisterOperand(ins, tokens[1]) && AddAddressOperand(ins, tokens[2]);
+                    }
+                    break;
+                case OP_PUSHM:                                          // PUSHM/POPM reg|reg-reg, ... (R0..R31)
+                case OP_POPM:
+                    ok = AddRegisterMaskOperand(ins, tokens);
+                    break;
+                case OP_STRLEN:                                         // STRLEN str
+                    ok = tokens.size() > 1 && AddStringOperand(ins, tokens[1]);
+                    break;
+                case OP_STRCPY:                                         // STRCPY/STRCAT/STRCMP/STRREV str, str
+                case OP_STRCAT:
+                case OP_STRCMP:
+                case OP_STRREV:
+                    ok = tokens.size() > 2 && AddStringOperand(ins, tokens[1]) && AddStringOperand(ins, tokens[2]);
+                    break;
+                case OP_PRINT_STR:                                      // PRINT_STR name
+                    ok = tokens.size() > 1 && AddSymbolOperand(ins, tokens[1]);
+                    break;
+                case OP_ADD:                                            // ADD/SUB/IMUL reg, reg|var|imm
+                case OP_SUB:
+                case OP_IMUL:
+                    ok = tokens.size() > 2 && AddRegisterOperand(ins, tokens[1]) && AddValueOperand(ins, tokens[2]);
+                    break;
+                case OP_IDIV:                                           // IDIV reg|var|imm
+                    ok = tokens.size() > 1 && AddValueOperand(ins, tokens[1]);
+                    break;
+                case OP_MOV:
+                    if (tokens.size() <= 2) {
+                        ok = false;
+                    } else if (IsRegister(tokens[1])) {                 // MOV reg, OFFSET name | <size> PTR [mem] | reg | var | imm
+                        AddRegisterOperand(ins, tokens[1]);
+                        if (tokens[2] == "OFFSET") {
+                            ok = tokens.size() > 3 && AddSymbolOperand(ins, tokens[3]);
+                        } else if (PtrWidth(tokens[2])) {
+                            ok = tokens.size() > 4 && tokens[3] == "PTR" && AddMemoryOperand(ins, tokens, 4, PtrWidth(tokens[2]));
+                        } else {
+                            ok = AddValueOperand(ins, tokens[2]);
+                        }
+                    } else if (IsVariable(tokens[1])) {                 // MOV var, reg | var | imm
+                        ins.ops[ins.operandCount++] = MakeOperand(OPND_VAR, LookupVariable(tokens[1]));
+                        ok = AddValueOperand(ins, tokens[2]);
+                    } else if (PtrWidth(tokens[1]) && tokens.size() > 4 && tokens[2] == "PTR") { // MOV <size> PTR [mem], reg|imm
+                        ok = AddMemoryOperand(ins, tokens, 3, PtrWidth(tokens[1])) && AddValueOperand(ins, tokens.back(), false);
+                    } else {
+                        ok = false;
+                    }
+                    break;
+                case OP_MOVZX:                                          // MOVZX reg, BYTE|WORD PTR [mem]
+                    ok = tokens.size() > 4 && (tokens[2] == "BYTE" || tokens[2] == "WORD") && tokens[3] == "PTR" &&
+                         AddRegisterOperand(ins, tokens[1]) && AddMemoryOperand(ins, tokens, 4, PtrWidth(tokens[2]));
+                    break;
+                case OP_CMP:                                            // CMP reg|var|imm, reg|var|imm
+                    ok = tokens.size() > 2 && AddValueOperand(ins, StripColon(tokens[1])) && AddValueOperand(ins, StripColon(tokens[2]));
+                    break;
+                case OP_JE: case OP_JNE: case OP_JL: case OP_JLE:      // Jcc/JMP/CALL label
+                case OP_JGE: case OP_JG: case OP_JA: case OP_JAE:
+                case OP_JB: case OP_JBE: case OP_JZ: case OP_JNZ:
+                case OP_JS: case OP_JNS: case OP_JO: case OP_JNO:
+                case OP_JMP: case OP_CALL:
+                    if (tokens.size() > 1) {
+                        Operand target = MakeOperand(OPND_LABEL, -1);   // Target index is filled in by LinkProgram()
+                        target.aux = InternSymbol(tokens[1]);
+                        ins.ops[ins.operandCount++] = target;
+                    } else {
+                        ok = false;
+                    }
+                    break;
+                default:
+                    if (IsSetcc(ins.opcode)) {                          // SETcc reg
+                        ok = tokens.size() > 1 && AddRegisterOperand(ins, tokens[1]);
+                    } else if (IsCmovcc(ins.opcode)) {                  // CMOVcc reg, reg|var|imm
+                        ok = tokens.size() > 2 && AddRegisterOperand(ins, tokens[1]) && AddValueOperand(ins, tokens[2]);
+                    }
+                    break;                                              // Otherwise an instruction without operands
+            }
+
+            if (!ok) {                                                  // Malformed operands: keep the line but do nothing
+                ins = Instruction{};                                    // OP_NOP with every slot empty (operands added so far dropped)
+            }
+            return ins;
+        }
+
+        bool LinkProgram() {                                            // Resolve label operands to instruction indices; false on undefined labels
+            for (size_t index = 0; index < code.size(); index++) {
+                Instruction& ins = code[index];
+                for (int i = 0; i < ins.operandCount; i++) {
+                    Operand& op = ins.ops[i];
+                    if (op.kind == OPND_LABEL) {
+                        auto it = labels.find(symbolNames[op.aux]);
+                        if (it != labels.end()) {
+                            op.value = it->second;              // Branches jump straight to this index
+                        } else {
+                            op.value = -1;
+                            LoadError("line " + to_string(codeLines[index]) + ": undefined label '" + symbolNames[op.aux] + "' in '" + programMemory[codeLines[index]] + "'");
+                        }
+                    }
+                }
+            }
+            ResolveSymbols();
+            return loadErrors.empty();
+        }
+
+        void LoadError(const string& message) {                         // Record (and trace) a problem found while loading
+            loadErrors.push_back(message);
+            VM_TRACE(TRACE_ERRORS) << "  -> LOAD ERROR: " << message << endl;
+        }
+
+        const vector<string>& LoadErrors() const { return loadErrors; } // Problems found by the last load (empty on success)
+
+        void ResolveSymbols() {                                         // Bind symbol names to string constants and buffers
+            symbols.assign(symbolNames.size(), ResolvedSymbol{nullptr, 0, false});
+            for (size_t i = 0; i < symbolNames.size(); i++) {
+                auto text = stringMemory.find(symbolNames[i]);
+                if (text != stringMemory.end()) {
+                    symbols[i].text = &text->second;
+                }
+                auto buffer = stringBuffers.find(symbolNames[i]);
+                if (buffer != stringBuffers.end()) {
+                    symbols[i].bufferAddress = buffer->second;
+                    symbols[i].isBuffer = true;
+                }
+            }
+        }
+
+        static int LookupOpcode(const string& mnemonic) {               // Mnemonic -> Opcode (-1 if unknown)
+            static unordered_map<string, int> table;
+            if (table.empty()) {
+                for (int i = OP_PUSH; i < OP_COUNT; i++) {
+                    table[OpcodeNames[i]] = i;
+                }
+            }
+            auto it = table.find(mnemonic);
+            return (it != table.end()) ? it->second : -1;
+        }
+
+        static Operand MakeOperand(uint8_t kind, int32_t value) {
+            Operand op = {};
+            op.kind = kind;
+            op.base = NO_REGISTER;
+            op.index = NO_REGISTER;
+            op.value = value;
+            return op;
+        }
+
+        static string StripColon(const string& token) {                 // Remove a trailing colon ("R0:" -> "R0")
+            if (!token.empty() && token.back() == ':') {
+                return token.substr(0, token.length() - 1);
+            }
+            return token;
+        }
+
+        int InternSymbol(const string& name) {                          // Add a name to the symbol table, return its id
+            auto it = symbolIds.find(name);
+            if (it != symbolIds.end()) return it->second;
+            int id = (int)symbolNames.size();
+            symbolNames.push_back(name);
+            symbolIds[name] = id;
+            return id;
+        }
+
+        bool AddRegisterOperand(Instruction& ins, const string& token) {
+            if (!IsRegister(token)) return false;
+            ins.ops[ins.operandCount++] = MakeOperand(OPND_REG, RegisterNumber(token));
+            return true;
+        }
+
+        bool AddRegisterMaskOperand(Instruction& ins, const vector<string>& tokens) { // Register list/ranges -> bit mask immediate
+            uint32_t mask = 0;
+            for (size_t i = 1; i < tokens.size(); i++) {
+                size_t dash = tokens[i].find('-');
+                int first = RegisterNumber(tokens[i].substr(0, dash));
+                int last = (dash == string::npos) ? first : RegisterNumber(tokens[i].substr(dash + 1));
+                if (first < 0 || last < first || last >= 32) return false;
+                for (int r = first; r <= last; r++) mask |= 1u << r;
+            }
+            if (mask == 0) return false;
+            ins.ops[ins.operandCount++] = MakeOperand(OPND_IMM, (int32_t)mask);
+            return true;
+        }
+
+        bool AddStringOperand(Instruction& ins, const string& token) {  // String buffer name or register holding an address
+            return IsRegister(token) ? AddRegisterOperand(ins, token) : AddSymbolOperand(ins, token);
+        }
+
+        bool AddSymbolOperand(Instruction& ins, const string& token) {
+            ins.ops[ins.operandCount++] = MakeOperand(OPND_SYMBOL, InternSymbol(token));
+            return true;
+        }
+
+        bool AddValueOperand(Instruction& ins, const string& token, bool allowVariable = true) { // Register, variable or immediate
+            if (IsRegister(token)) return AddRegisterOperand(ins, token);
+            if (allowVariable && (IsVariable(token) || token == "matrixAllocated")) {
+                ins.ops[ins.operandCount++] = MakeOperand(OPND_VAR, LookupVariable(token));
+                return true;
             }
-            nextMemoryAddress += size;                              // Update next available address
-            cout << "  -> Allocated " << size << " bytes at address 0x" << hex << address << dec << endl;
-            return address;                                         // Return base address of allocated block
+            int value;
+            if (!ParseImmediate(token, value)) return false;
+            ins.ops[ins.operandCount++] = MakeOperand(OPND_IMM, value);
+            return true;
+        }
+
+        bool AddAddressOperand(Instruction& ins, const string& token) { // [imm] or a register holding the address (DWORD access)
+            Operand op = MakeOperand(OPND_MEM, 0);
+            op.width = DWORD_SIZE;
+            if (token.size() > 2 && token[0] == '[' && token.back() == ']') {
+                if (!ParseImmediate(token.substr(1, token.length() - 2), op.value)) return false;
+            } else if (IsRegister(token)) {
+                op.base = (uint8_t)RegisterNumber(token);
+            } else {
+                return false;
+            }
+            ins.ops[ins.operandCount++] = op;
+            return true;
         }
 
-        void FreeVirtualMemory(int address, int size) {                 // Deallocates memory block at given address
-            for (int i = 0; i < size; i++) {                            // Loop through each element to free
-                virtualMemory.erase(address + i);                       // Remove memory entry from virtualMemory map
+        static int PtrWidth(const string& token) {                      // Size keyword before PTR -> bytes (0 if not a size keyword)
+            if (token == "BYTE") return BYTE_SIZE;
+            if (token == "WORD") return WORD_SIZE;
+            if (token == "DWORD") return DWORD_SIZE;
+            return 0;
+        }
+
+        bool AddMemoryOperand(Instruction& ins, const vector<string>& tokens, size_t start, int width) { // [base + index|disp] spread over tokens
+            string expr;
+            size_t i = start;
+            for (; i < tokens.size(); i++) {                            // Join tokens from '[' up to the one ending in ']'
+                expr += tokens[i];
+                if (tokens[i].back() == ']') break;
+            }
+            if (expr.size() < 3 || expr[0] != '[' || expr.back() != ']') return false;
+            expr = expr.substr(1, expr.length() - 2);
+
+            Operand op = MakeOperand(OPND_MEM, 0);
+            op.width = (uint8_t)width;
+            stringstream terms(expr);
+            string term;
+            while (getline(terms, term, '+')) {                         // Each term is a register or a displacement
+                if (IsRegister(term)) {
+                    if (op.base == NO_REGISTER) op.base = (uint8_t)RegisterNumber(term);
+                    else if (op.index == NO_REGISTER) op.index = (uint8_t)RegisterNumber(term);
+                    else return false;
+                } else {
+                    int displacement;
+                    if (!ParseImmediate(term, displacement)) return false;
+                    op.value += displacement;
+                }
             }
-            cout << "  -> Freed memory at address 0x" << hex << address << dec << endl;
+            ins.ops[ins.operandCount++] = op;
+            return true;
         }
 
-        int ReadVirtualMemory(int address) {                            // Reads value from virtual memory address
-            if (virtualMemory.find(address) != virtualMemory.end()) {   // Check if address exists in memory
-                return virtualMemory[address];                          // Return value stored at memory address
+        bool ParseImmediate(const string& token, int& value) {          // Decimal or 0x-prefixed hexadecimal constant
+            try {
+                if (token.substr(0, 2) == "0x") {
+                    value = stoi(token.substr(2), 0, 16);
+                } else {
+                    value = stoi(token);
+                }
+                return true;
+            } catch (...) {
+                VM_TRACE(TRACE_ERRORS) << "  -> ERROR: Invalid operand '" << token << "'" << endl;
+                return false;
             }
-            // cout << "  -> ERROR: Memory read from invalid address 0x" << hex << address << dec << endl;
-            return 0;                                                   // Return 0 for invalid memory access
         }
 
-        void WriteVirtualMemory(int address, int value) {               // Writes value to virtual memory address
-            virtualMemory[address] = value;                             // Store value in virtualMemory map at address
+        // ========== FLAGS ==========
+        // Lazy flags: ADD, SUB, CMP, INC, DEC and MOV only record what they did (flagOp, operands,
+        // result); ZF/SF/OF/CF are derived when something reads them (Jcc, traces, the JIT,
+        // DescribeState), and only the bits asked for. When flagOp is FLAGS_KNOWN the flags are
+        // the ZF..CF members; after INC/DEC the CF member, and after MOV the OF and CF members,
+        // hold the bits those partial updates leave alone. OF and CF follow x86: CF is the
+        // unsigned carry of ADD and the borrow of SUB/CMP.
+        void SetArithmeticFlags(FlagOp op, int32_t left, int32_t right, int32_t result) { // ADD or SUB/CMP: all four flags
+            flagOp = op;
+            flagLeft = left;
+            flagRight = right;
+            flagResult = result;
         }
-        
-        // Helper to write string to memory (byte by byte)
-        void WriteStringToMemory(int baseAddress, const string& str) {
-            for (size_t i = 0; i < str.length(); i++) {
-                WriteVirtualMemory(baseAddress + i, (int)(unsigned char)str[i]);
+
+        void SetIncDecFlags(FlagOp op, int32_t result) {                // INC/DEC: ZF, SF, OF (CF kept)
+            CF = CarryFlag();
+            flagOp = op;
+            flagResult = result;
+        }
+
+        void SetResultFlags(int32_t result) {                           // MOV to a register: ZF, SF (OF and CF kept)
+            OF = OverflowFlag();
+            CF = CarryFlag();
+            flagOp = FLAGS_MOV;
+            flagResult = result;
+        }
+
+        void SetFlags(bool zero, bool sign, bool overflow, bool carry) { // Explicit flags (IMUL, IDIV, JIT exits)
+            ZF = zero; SF = sign; OF = overflow; CF = carry;
+            flagOp = FLAGS_KNOWN;
+        }
+
+        bool ZeroFlag() const { return (flagOp == FLAGS_KNOWN) ? ZF : flagResult == 0; }
+        bool SignFlag() const { return (flagOp == FLAGS_KNOWN) ? SF : flagResult < 0; }
+        bool OverflowFlag() const {
+            switch (flagOp) {
+                case FLAGS_ADD: return ((flagLeft ^ flagResult) & (flagRight ^ flagResult)) < 0; // Same-sign operands, other-sign result
+                case FLAGS_SUB: return ((flagLeft ^ flagRight) & (flagLeft ^ flagResult)) < 0;  // Different-sign operands, result sign flipped
+                case FLAGS_INC: return flagResult == INT_MIN;
+                case FLAGS_DEC: return flagResult == INT_MAX;
+                default:        return OF;
             }
-            WriteVirtualMemory(baseAddress + str.length(), 0);  // Null terminator
         }
-        
-        // Helper to read string from memory
-        string ReadStringFromMemory(int baseAddress, int maxLength = 200) {
-            string result = "";
-            for (int i = 0; i < maxLength; i++) {
-                int charValue = ReadVirtualMemory(baseAddress + i);
-                if (charValue == 0) break;  // Null terminator
-                result += (char)charValue;
+        bool CarryFlag() const {
+            switch (flagOp) {
+                case FLAGS_ADD: return (uint32_t)flagResult < (uint32_t)flagLeft; // Unsigned wrap-around
+                case FLAGS_SUB: return (uint32_t)flagLeft < (uint32_t)flagRight;  // Borrow
+                default:        return CF;
             }
-            return result;
         }
-        
-        // Helper to get address of string buffer by name
-        int GetStringBufferAddress(const string& bufferName) {
-            if (stringBuffers.find(bufferName) != stringBuffers.end()) {
-                return stringBuffers[bufferName];
+        bool ConditionHolds(int cond) const {                           // Jcc/SETcc/CMOVcc condition (Condition)
+            if (flagOp == FLAGS_SUB) {                                  // After SUB/CMP: compare the operands directly
+                uint32_t left = (uint32_t)flagLeft, right = (uint32_t)flagRight;
+                switch (cond) {
+                    case COND_L:  return flagLeft < flagRight;
+                    case COND_GE: return flagLeft >= flagRight;
+                    case COND_LE: return flagLeft <= flagRight;
+                    case COND_G:  return flagLeft > flagRight;
+                    case COND_B:  return left < right;
+                    case COND_AE: return left >= right;
+                    case COND_BE: return left <= right;
+                    case COND_A:  return left > right;
+                }
             }
-            cout << "  -> ERROR: String buffer '" << bufferName << "' not found!" << endl;
-            return 0;
+            bool holds = false;
+            switch (cond & ~1) {                                        // Even conditions; odd ones are their negation
+                case COND_E:  holds = ZeroFlag(); break;
+                case COND_L:  holds = SignFlag() != OverflowFlag(); break;
+                case COND_LE: holds = ZeroFlag() || SignFlag() != OverflowFlag(); break;
+                case COND_B:  holds = CarryFlag(); break;
+                case COND_BE: holds = CarryFlag() || ZeroFlag(); break;
+                case COND_S:  holds = SignFlag(); break;
+                case COND_O:  holds = OverflowFlag(); break;
+            }
+            return holds != (bool)(cond & 1);
         }
 
-        int GetMatrixElementAddress(int baseAddress, int row, int col, int size) {
-            return baseAddress + (row * size + col) * 4;                // Calculate address: base + (row*size + col) * 4 bytes
+        // ========== OPERAND ACCESS ==========
+        int& Reg(int index) {                                           // Register by decoded number
+            return regs[index];
         }
-        
-        void LoadProgram(const string& filename) {                      // Loads assembly program from file into memory
-            ifstream file(filename);                                    // Open input file stream for reading
-            string line;                                                // Store each line read from file
-            vector<string> tempProgram;                                 // Temporary storage for program instructions
-            int lineNum = 0;                                            // Track current line number during loading
-            
-            cout << "=== LOADING PROGRAM ===" << endl;                  // Print loading header
-            
-            while (getline(file, line)) {                               // Read file line by line until EOF
-                size_t commentPos = line.find(';');                     // Find position of comment delimiter
-                if (commentPos != string::npos) {                       // Check if comment exists in line
-                    line = line.substr(0, commentPos);                  // Remove comment portion from line
-                }
-                line.erase(0, line.find_first_not_of(" \t"));           // Remove leading whitespace and tabs
-                line.erase(line.find_last_not_of(" \t") + 1);           // Remove trailing whitespace and tabs
-                
-                if (!line.empty()) {                                    // Check if line is not empty after cleaning
-                    cout << "Line " << lineNum << ": " << line << endl; // Print processed line
-                    tempProgram.push_back(line);                        // Add instruction to temporary program storage
-                    
-                    if (line.back() == ':') {                           // Check if line ends with colon (label definition)
-                        string label = line.substr(0, line.length() - 1); // Extract label name without colon
-                        labels[label] = lineNum;                        // Store label with its line number in labels map
-                        cout << "  -> LABEL FOUND: '" << label << "' at position " << lineNum << endl;
+
+        // Compatibility accessors for code that still addresses registers by name ("R0")
+        int GetRegister(const string& name) {
+            int index = RegisterNumber(name);
+            return (index >= 0) ? regs[index] : 0;
+        }
+
+        void SetRegister(const string& name, int value) {
+            int index = RegisterNumber(name);
+            if (index >= 0) regs[index] = value;
+        }
+
+        int ReadOperand(const Operand& op) {                            // Value of a register, variable or immediate operand
+            switch (op.kind) {
+                case OPND_REG: return Reg(op.value);
+                case OPND_VAR: return GetVariableValue(op.value);
+                default:       return op.value;
+            }
+        }
+
+        int EffectiveAddress(const Operand& op) {                       // Address of an OPND_MEM operand
+            int address = op.value;
+            if (op.base != NO_REGISTER) address += Reg(op.base);
+            if (op.index != NO_REGISTER) address += Reg(op.index);
+            return address;
+        }
+
+        string OperandText(const Operand& op) {                         // Operand as written in the source (for tracing)
+            switch (op.kind) {
+                case OPND_REG:    return "R" + to_string(op.value);
+                case OPND_VAR:    return VariableNames[op.value];
+                case OPND_LABEL:  return symbolNames[op.aux];
+                case OPND_SYMBOL: return symbolNames[op.value];
+                case OPND_MEM: {
+                    static const char* const widthNames[5] = { "", "BYTE PTR ", "WORD PTR ", "", "DWORD PTR " };
+                    string text = string(widthNames[op.width]) + "[";
+                    if (op.base != NO_REGISTER) text += "R" + to_string(op.base);
+                    if (op.index != NO_REGISTER) text += " + R" + to_string(op.index);
+                    if (op.value != 0 || op.base == NO_REGISTER) {
+                        text += (op.base == NO_REGISTER ? "0x" : " + ");
+                        stringstream number;
+                        if (op.base == NO_REGISTER) number << hex;
+                        number << op.value;
+                        text += number.str();
                     }
-                    lineNum++;                                          // Increment line counter for next instruction
+                    return text + "]";
                 }
+                default:          return to_string(op.value);
             }
-            file.close();                                               // Close the input file
-            programMemory = tempProgram;                                // Copy temporary program to program memory
-            cout << "\n=== PROGRAM LOADED ===" << endl;                 // Print loading completion header
-            cout << "Total instructions: " << programMemory.size() << endl; // Display instruction count
-            cout << "Labels found: " << labels.size() << endl;          // Display number of labels found
-            for (auto& label : labels) {                                // Iterate through all labels in map
-                cout << "  " << label.first << " -> line " << label.second << endl; // Print label mapping
+        }
+
+        unsigned long long InstructionsExecuted() const {               // Number of instructions dispatched so far
+            return instructionsExecuted;
+        }
+
+        // ========== DISPATCH ENGINE ==========
+        typedef bool (VirtualMachine::*Handler)(const Instruction&);    // Opcode handler, returns whether to increment PC
+
+        bool executeInstruction(int opcode, const Instruction& ins) {   // Execute one decoded instruction through the handler table
+            static const Handler handlers[DISPATCH_COUNT] = {           // Indexed by Opcode (generated from both opcode lists)
+#define VM_OPCODE_HANDLER(name, text, handler) &VirtualMachine::Execute##handler,
+                VM_OPCODE_LIST(VM_OPCODE_HANDLER)
+                VM_SUPERINSTRUCTION_LIST(VM_OPCODE_HANDLER)
+                VM_JIT_OPCODE_LIST(VM_OPCODE_HANDLER)
+#undef VM_OPCODE_HANDLER
+            };
+            return (this->*handlers[opcode])(ins);
+        }
+
+        // Dispatch opcode of every instruction: its own opcode, or a superinstruction that also
+        // covers the instructions after it. The instructions themselves are never rewritten
+        // (images may be mapped read-only) and jumps into the middle of a fused sequence still
+        // land on the original, unfused entry. With the JIT on, branch targets get a JIT_PROBE
+        // instead. Fused sequences trace every component, so fusion stays on at TRACE_FULL (the
+        // default); native code cannot trace, so the JIT is skipped there.
+        const uint16_t* DispatchOps() {
+            int mode = 0;
+            if (superinstructions) mode |= DISPATCH_FUSED;
+            if (jitEnabled && VM_HAVE_JIT && !Tracing(TRACE_FULL)) mode |= DISPATCH_JIT;
+            if (dispatchBuiltFor != mode || dispatchOps.size() != (size_t)programLength) {
+                BuildDispatchOps(mode);
             }
-            cout << "======================\n" << endl;                 // Print section footer
+            return dispatchOps.data();
         }
-        
-        void run() {                                                    // Main VM execution loop
-            programCounter = 0;                                         // Initialize program counter [PC = EIP] to start of program
-            
-            while (programCounter < programMemory.size() && running) {  // Loop while within bounds and VM running
-                string instruction = programMemory[programCounter];     // Fetch instruction at current PC
-                cout << "\n\033[1;36m[PC=" << programCounter << "] \033[0mExecuting: \033[1;32m" << instruction << " \033[0m" << endl; // Display execution info
-                vector<string> tokens = Tokenize(instruction);          // Split instruction into tokens (opcode, operands)
-                
-                if (!tokens.empty()) {                                  // Check if instruction has valid tokens
-                    string opcode = tokens[0];                          // Extract first token as opcode
-                    if (opcode.back() == ':') {                         // Check if current line is a label definition
-                        programCounter++;                               // Skip label line (no execution needed)
-                        continue;                                       // Move to next instruction
-                    }
-                    
-                    if (opcode == "CALL") {                             // Handle function CALL instruction
-                        if (tokens.size() > 1) {                        // Verify CALL has target label operand
-                            string label = tokens[1];                   // Extract label name from tokens
-                            if (labels.find(label) != labels.end()) {   // Check if label exists in label map
-                                callStack.push(programCounter + 1);     // Push return address (next instruction) onto stack
-                                programCounter = labels[label];         // Jump PC to label address
-                                cout << "  -> CALL: jumping to " << label << " at line " << programCounter << endl;
-                                continue;                               // Skip PC increment for direct jump
-                            } else {
-                                cout << "  -> ERROR: Label '" << label << "' not found!" << endl; // Label error
-                            }
-                        }
-                    } else if (opcode == "RET") {                       // Handle return from function call
-                        if (!callStack.empty()) {                       // Verify call stack has return address
-                            int returnAddress = callStack.top();        // Get return address from stack top
-                            callStack.pop();                            // Remove return address from stack
-                            programCounter = returnAddress;             // Jump PC back to return address
-                            cout << "  -> RET: returning to line " << programCounter << endl;
-                            continue;                                   // Skip PC increment for direct jump
-                        } else {
-                            cout << "  -> ERROR: RET with empty call stack!" << endl; // Stack underflow error
-                        }
+
+        void BuildDispatchOps(int mode) {
+            dispatchBuiltFor = mode;
+            dispatchOps.resize(programLength);
+            fusedCount = 0;
+            for (int i = 0; i < programLength; i++) {
+                dispatchOps[i] = (uint16_t)BaseDispatchOp(i);
+                if (dispatchOps[i] != program[i].opcode) fusedCount++;
+            }
+            jitHotness.assign((mode & DISPATCH_JIT) ? programLength : 0, 0); // Compiled code belongs to the old program
+            jitEntries.assign(jitHotness.size(), nullptr);
+            jitCode.clear();
+            if (mode & DISPATCH_JIT) {
+                for (int i = 0; i < programLength; i++) {               // Branch targets start regions
+                    const Operand& target = program[i].ops[0];
+                    if (program[i].operandCount > 0 && target.kind == OPND_LABEL && target.value >= 0 && target.value < programLength &&
+                        JitCompiler::Supported(program[target.value])) {
+                        dispatchOps[target.value] = OP_JIT_PROBE;
                     }
                 }
-                bool shouldIncrementPC = executeInstruction(instruction); // Execute instruction, get PC increment flag
-                if (shouldIncrementPC) { programCounter++; }              // Check if PC should advance to next instruction (if yes increment)
-                
-                if (programCounter >= programMemory.size()) {             // Check if PC reached end of program memory
-                    cout << "Program reached end." << endl;               // Print program completion message
-                    break;                                                // Exit execution loop
-                }
             }
         }
-        
-        bool executeInstruction(const string& instruction) {            // Execute single instruction, return whether to increment PC
-            vector<string> tokens = Tokenize(instruction);              // Split instruction into opcode and operands
-            if (tokens.empty()) return true;                            // Return true for empty lines (increment PC)
-            
-            string opcode = tokens[0];                                  // Extract instruction mnemonic (first token)
-            bool incrementPC = true;                                    // Default: move to next instruction after execution
-            
-            // ========== STACK OPERATIONS ==========
-            if (opcode == "PUSH") {                                 // Check if instruction is PUSH
-                if (tokens.size() > 1) {                                // Verify that at least 2 tokens exist (PUSH, operand)
-                    // Remove colon if present (e.g., "PUSH R0:" -> "PUSH R0")
-                    string operand = tokens[1];                         // Extract the operand token
-                    if (operand.back() == ':') {                        // Check if colon is present at the end
-                        operand = operand.substr(0, operand.length() - 1); // Remove the trailing colon
+
+        int BaseDispatchOp(int i) const {                              // Opcode or superinstruction for instruction i
+            int fused = (dispatchBuiltFor & DISPATCH_FUSED) ? SuperinstructionAt(i) : -1;
+            return (fused >= 0) ? fused : program[i].opcode;
+        }
+
+        int SuperinstructionAt(int i) const {                           // Longest superinstruction starting at i, or -1
+            auto opcodeAt = [&](int k) { return (i + k < programLength) ? (int)program[i + k].opcode : -1; };
+            switch (opcodeAt(0)) {
+                case OP_CMP:                                            // CMP a, b / Jcc label
+                    switch (opcodeAt(1)) {
+                        case OP_JE:  return OP_CMP_JE;
+                        case OP_JNE: return OP_CMP_JNE;
+                        case OP_JL:  return OP_CMP_JL;
+                        case OP_JLE: return OP_CMP_JLE;
+                        case OP_JGE: return OP_CMP_JGE;
                     }
-                    
-                    int value;                                          // Declare variable to hold the value to push
-                    if (IsRegister(operand)) {                          // Check if operand is a register
-                        value = registers[operand];                     // Get value from the register
-                    } else if (IsVariable(operand)) {                   // Check if operand is a variable
-                        value = GetVariableValue(operand);              // Get value from the variable
-                    } else {                                            // Operand must be an immediate value
-                        value = stoi(operand);                          // Convert string to integer
+                    break;
+                case OP_MOVZX:                                          // MOVZX r, BYTE PTR [src] / MOV BYTE PTR [dst], r [/ INC i [/ JMP loop]]
+                    if (opcodeAt(1) == OP_MOV && program[i + 1].ops[0].kind == OPND_MEM) {
+                        if (opcodeAt(2) != OP_INC) return OP_MOVZX_STORE;
+                        return (opcodeAt(3) == OP_JMP) ? OP_MOVZX_STORE_INC_JMP : OP_MOVZX_STORE_INC;
                     }
-                    dataStack.push(value);                              // Push the value onto the data stack
-                    cout << "  -> PUSH: value = " << value  << ", stack size = " << dataStack.size() << endl;
-                }
+                    break;
+                case OP_INC:                                            // INC i / JMP loop
+                    if (opcodeAt(1) == OP_JMP) return OP_INC_JMP;
+                    break;
             }
-            else if (opcode == "POP") {                             // Check if instruction is POP
-                if (tokens.size() > 1) {                                // Verify that at least 2 tokens exist (POP, destination)
-                    // Remove colon if present
-                    string operand = tokens[1];                         // Extract the destination operand token
-                    if (operand.back() == ':') {                        // Check if colon is present at the end
-                        operand = operand.substr(0, operand.length() - 1); // Remove the trailing colon
-                    }
-                    
-                    if (IsRegister(operand)) {                          // Check if destination is a register
-                        if (!dataStack.empty()) {                       // Check if the stack is not empty
-                            registers[operand] = dataStack.top();       // Get top value from stack and store in register
-                            dataStack.pop();                            // Remove the top value from the stack
-                            cout << "  -> POP: " << operand << " = "  << registers[operand] << ", stack size = "  << dataStack.size() << endl;
-                        } else {                                        // Stack is empty
-                            cout << "  -> ERROR: Stack underflow!" << endl; // Print error message
-                        }
-                    }
-                }
+            return -1;
+        }
+
+        void SetSuperinstructions(bool enabled) { superinstructions = enabled; } // On by default; off for debugging
+        int FusedInstructionCount() const { return fusedCount; }       // Superinstructions chosen by the last fusion pass
+
+        // ========== JIT TIER ==========
+        void SetJit(bool enabled) { jitEnabled = enabled; }            // Off by default (--jit); needs VM_HAVE_JIT
+        void SetJitThreshold(uint32_t visits) { jitThreshold = max(1u, visits); }
+        int JitRegionCount() const { return (int)jitCode.size(); }     // Regions compiled during the last run
+
+        bool ExecuteJitProbe(const Instruction& ins) {                 // Count visits of a branch target, compile it once hot
+            int pc = programCounter;
+            if (++jitHotness[pc] < jitThreshold) return executeInstruction(BaseDispatchOp(pc), ins);
+            if (!CompileJitRegion(pc)) {                                // Not compilable: stop probing here
+                dispatchOps[pc] = (uint16_t)BaseDispatchOp(pc);
+                return executeInstruction(dispatchOps[pc], ins);
             }
-            
-            // ========== MEMORY MANAGEMENT INSTRUCTIONS ==========
-            else if (opcode == "ALLOC") {                           // Allocate memory block instruction
-                if (tokens.size() > 2 && IsRegister(tokens[1]) && IsRegister(tokens[2])) {
-                    int size = registers[tokens[1]];                // Get size from source register
-                    int address = AllocateVirtualMemory(size);      // Allocate memory of specified size
-                    registers[tokens[2]] = address;                 // Store base address in destination register
-                    cout << "  -> ALLOC: allocated " << size << " elements, address in " << tokens[2] << endl;
-                }
+            dispatchOps[pc] = OP_JIT_ENTER;
+            return ExecuteJitEnter(ins);
+        }
+
+        bool ExecuteJitEnter(const Instruction& ins) {                 // Run the native code of the region starting here
+            JitFrame frame;
+            memcpy(frame.regs, regs, sizeof(regs));
+            frame.zf = ZeroFlag(); frame.sf = SignFlag(); frame.of = OverflowFlag(); frame.cf = CarryFlag();
+            frame.vm = this;
+            int32_t next = jitEntries[programCounter](&frame);
+            memcpy(regs, frame.regs, sizeof(regs));
+            SetFlags(frame.zf != 0, frame.sf != 0, frame.of != 0, frame.cf != 0);
+            if (next < 0) {                                             // Bailed out before ~next (IDIV by zero): interpret it
+                programCounter = ~next;
+                const Instruction& stop = program[programCounter];
+                return executeInstruction(stop.opcode, stop);
             }
-            else if (opcode == "FREE") {                            // Deallocate memory block instruction
-                if (tokens.size() > 2 && IsRegister(tokens[1]) && IsRegister(tokens[2])) {
-                    int address = registers[tokens[1]];             // Get base address from register
-                    int size = registers[tokens[2]];                // Get size from register
-                    FreeVirtualMemory(address, size);               // Free the memory block
-                    cout << "  -> FREE: freed memory at address in " << tokens[1] << endl;
-                }
+            programCounter = next;
+            return false;
+        }
+
+        bool CompileJitRegion(int start) {
+            vector<uint8_t> native;
+            JitCompiler compiler(program, programLength, &VirtualMachine::JitLoad, &VirtualMachine::JitStore);
+            if (!compiler.Compile(start, native)) return false;
+            unique_ptr<ExecutableMemory> memory(new ExecutableMemory());
+            if (!memory->Install(native)) return false;
+            jitEntries[start] = memory->Entry();
+            jitCode.push_back(move(memory));
+            return true;
+        }
+
+        static uint32_t JitLoad(JitFrame* frame, int32_t address, int32_t width) { // Guest memory for compiled code
+            return frame->vm->virtualMemory.Read(address, width);
+        }
+        static void JitStore(JitFrame* frame, int32_t address, int32_t value, int32_t width) {
+            frame->vm->WriteVirtualMemory(address, value, width);
+        }
+
+        string DescribeState(int memoryAddress, int memorySize) {      // Registers, flags, PC and a memory range, as text
+            ostringstream text;
+            for (int i = 0; i < VM_REGISTER_COUNT; i++) text << "R" << i << "=" << regs[i] << " ";
+            text << "ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << " PC=" << programCounter << "\n";
+            for (int i = 0; i < memorySize; i++) {
+                text << hex << ReadVirtualMemory(memoryAddress + i, BYTE_SIZE) << (i % 32 == 31 ? "\n" : " ");
             }
-            else if (opcode == "STORE") {                           // Store value to memory instruction
-                if (tokens.size() > 2) {
-                    string addrToken = tokens[1];                   // Token containing memory address
-                    string valueToken = tokens[2];                  // Token containing value to store
-                    int address = 0;                                // Parsed memory address
-                    int value = 0;                                  // Parsed value to store
-                    
-                    if (addrToken[0] == '[' && addrToken.back() == ']') {               // Check for direct memory addressing [address]
-                        string addrStr = addrToken.substr(1, addrToken.length() - 2);   // Remove brackets
-                        if (addrStr.substr(0, 2) == "0x") {                             // Check if hexadecimal address
-                            address = stoi(addrStr.substr(2), 0, 16);                   // Convert hex string to integer
-                        } else {
-                            address = stoi(addrStr);                                    // Convert decimal string to integer
-                        }
-                    } else if (IsRegister(addrToken)) {                                 // Check if address is in register
-                        address = registers[addrToken];                                 // Get address from register
-                    }
+            return text.str();
+        }
 
-                    if (IsRegister(valueToken)) {                                       // Check if value is in register
-                        value = registers[valueToken];                                  // Get value from register
-                    } else {
-                        value = stoi(valueToken);                                       // Parse immediate value
-                    }
-                    WriteVirtualMemory(address, value);                                 // Write value to memory address
-                    cout << "  -> STORE: value " << value << " to address 0x" << hex << address << dec << endl;
-                }
+        bool Tracing(int level) const { return traceLevel >= level; } // True if output at this level is enabled
+        void SetTraceLevel(TraceLevel level) { traceLevel = level; }
+        ostream& TraceStream() { guestOut.Flush(); return cout; }      // Trace sink, ordered after pending guest output
+        GuestOutput& Output() { return guestOut; }                     // Select the guest output sink (stdout, file, memory)
+
+        void SetBatchMode(bool enabled) { batchMode = enabled; }
+        void InputFromStream(istream& in) { guestIn = &in; ownedInput.reset(); } // Caller keeps the stream alive
+        void InputFromString(const string& script) {                   // Scripted input, e.g. a recorded session
+            ownedInput.reset(new istringstream(script));
+            guestIn = ownedInput.get();
+        }
+        bool InputFromFile(const string& path) {                       // Returns false if the file cannot be opened
+            unique_ptr<ifstream> file(new ifstream(path));
+            if (!file->is_open()) return false;
+            ownedInput = move(file);
+            guestIn = ownedInput.get();
+            return true;
+        }
+
+        bool InputExhausted() {                                         // In batch mode, running out of input stops the program
+            if (!batchMode || *guestIn) return false;
+            running = false;
+            VM_TRACE(TRACE_ERRORS) << "  -> ERROR: batch input exhausted, stopping" << endl;
+            return true;
+        }
+
+        // ========== STACKS AND FAULTS ==========
+        // The data stack lives either in the host-side BoundedStack or, after SetGuestDataStack(),
+        // in a guest memory block addressed by R(N-1) as ESP: PUSH stores a DWORD at ESP - 4 and
+        // moves ESP down, POP loads [ESP] and moves it up. Running past either end is a fault.
+        static const int STACK_POINTER = VM_REGISTER_COUNT - 1;         // ESP register of the guest-memory data stack
+
+        void SetStackCapacity(int callDepth, int dataDepth) {           // Before run(): reallocates and empties both stacks
+            callStack.Reserve(max(1, callDepth));
+            dataStack.Reserve(max(1, dataDepth));
+        }
+
+        void SetGuestDataStack(bool enabled) {                          // Move the data stack into guest memory (ESP = R(N-1))
+            if (enabled == (guestStackTop != 0)) return;
+            if (enabled) {
+                int bytes = dataStack.Capacity() * DWORD_SIZE;
+                guestStackBase = AllocateVirtualMemory(bytes);
+                guestStackTop = guestStackBase + bytes;
+                Reg(STACK_POINTER) = guestStackTop;                     // Empty stack: ESP at the top, grows down
+            } else {
+                FreeVirtualMemory(guestStackBase);
+                guestStackBase = guestStackTop = 0;
             }
-            else if (opcode == "LOAD") {                            // Load value from memory to register
-                if (tokens.size() > 2 && IsRegister(tokens[1])) {
-                    string addrToken = tokens[2];                   // Token containing memory address
-                    int address = 0;                                // Parsed memory address
-                    
-                    if (addrToken[0] == '[' && addrToken.back() == ']') {               // Direct memory addressing
-                        string addrStr = addrToken.substr(1, addrToken.length() - 2);   // Remove brackets
-                        if (addrStr.substr(0, 2) == "0x") {                             // Hexadecimal address
-                            address = stoi(addrStr.substr(2), 0, 16);                   // Convert hex to integer
-                        } else {
-                            address = stoi(addrStr);                                    // Convert decimal to integer
-                        }
-                    } else if (IsRegister(addrToken)) {                                 // Address stored in register
-                        address = registers[addrToken];                                 // Get address from register
-                    }
-                    
-                    int value = ReadVirtualMemory(address);                             // Read value from memory
-                    registers[tokens[1]] = value;                                       // Store value in destination register
-                    cout << "  -> LOAD: from address 0x" << hex << address << " to " << tokens[1] << " = " << value << dec << endl;
-                }
+        }
+
+        bool DataPush(int32_t value) {                                  // False on overflow (or an ESP outside the stack block)
+            if (guestStackTop == 0) return dataStack.Push(value);
+            int sp = Reg(STACK_POINTER);
+            if (sp - DWORD_SIZE < guestStackBase || sp > guestStackTop) return false;
+            sp -= DWORD_SIZE;
+            WriteVirtualMemory(sp, value, DWORD_SIZE);
+            Reg(STACK_POINTER) = sp;
+            return true;
+        }
+
+        bool DataPop(int32_t& value) {                                  // False on underflow (or an ESP outside the stack block)
+            if (guestStackTop == 0) return dataStack.Pop(value);
+            int sp = Reg(STACK_POINTER);
+            if (sp < guestStackBase || sp + DWORD_SIZE > guestStackTop) return false;
+            value = ReadVirtualMemory(sp, DWORD_SIZE);
+            Reg(STACK_POINTER) = sp + DWORD_SIZE;
+            return true;
+        }
+
+        bool DataPushBlock(const int32_t* values, int count) {          // As count DataPush calls, values[0] first; all or nothing
+            if (guestStackTop == 0) return dataStack.PushBlock(values, count);
+            int sp = Reg(STACK_POINTER);
+            if (sp - count * DWORD_SIZE < guestStackBase || sp > guestStackTop) return false;
+            for (int i = 0; i < count; i++) WriteVirtualMemory(sp - (i + 1) * DWORD_SIZE, values[i], DWORD_SIZE);
+            Reg(STACK_POINTER) = sp - count * DWORD_SIZE;
+            return true;
+        }
+
+        bool DataPopBlock(int32_t* values, int count) {                 // Inverse of DataPushBlock; all or nothing
+            if (guestStackTop == 0) return dataStack.PopBlock(values, count);
+            int sp = Reg(STACK_POINTER);
+            if (sp < guestStackBase || sp + count * DWORD_SIZE > guestStackTop) return false;
+            for (int i = 0; i < count; i++) values[i] = ReadVirtualMemory(sp + (count - 1 - i) * DWORD_SIZE, DWORD_SIZE);
+            Reg(STACK_POINTER) = sp + count * DWORD_SIZE;
+            return true;
+        }
+
+        int DataStackSize() {                                           // Entries currently on the data stack
+            if (guestStackTop == 0) return dataStack.Size();
+            return (guestStackTop - Reg(STACK_POINTER)) / DWORD_SIZE;
+        }
+
+        bool Fault(const string& message) {                             // Stop the guest program; handlers return this (PC stays put)
+            faultMessage = message + " at line " + to_string(LineOf(programCounter));
+            running = false;
+            guestOut.Flush();
+            VM_TRACE(TRACE_ERRORS) << "  -> FAULT: " << faultMessage << endl;
+            return false;
+        }
+
+        const string& FaultMessage() const { return faultMessage; }     // Empty unless the last run ended in a fault
+
+        static bool ParseTraceLevel(const string& name, TraceLevel& level) { // "off" / "errors" / "calls" / "full" / "debug"
+            for (int i = TRACE_OFF; i <= TRACE_DEBUG; i++) {
+                if (name == TraceLevelNames[i]) { level = (TraceLevel)i; return true; }
             }
-            else if (opcode == "GET_ELEMENT_ADDR") {                // Calculate matrix element address
-                if (tokens.size() > 5 && IsRegister(tokens[1]) && IsRegister(tokens[2]) && 
-                    IsRegister(tokens[3]) && IsRegister(tokens[4]) && IsRegister(tokens[5])) {
-                    int baseAddr = registers[tokens[2]];            // Matrix base address
-                    int row = registers[tokens[3]];                 // Row index
-                    int col = registers[tokens[4]];                 // Column index
-                    int size = registers[tokens[5]];                // Matrix dimension size
-                    int elementAddr = GetMatrixElementAddress(baseAddr, row, col, size); // Calculate address
-                    registers[tokens[1]] = elementAddr;             // Store calculated address in destination register
-                    cout << "  -> GET_ELEMENT_ADDR: [" << row << "][" << col << "] -> 0x" << hex << elementAddr << dec << endl;
+            return false;
+        }
+
+        void TraceStep(const Instruction& ins) {                        // Per-instruction execution trace
+            VM_TRACE(TRACE_FULL) << "\n\033[1;36m[PC=" << programCounter << "] \033[0mExecuting: \033[1;32m" << SourceText(programCounter) << " \033[0m" << endl; // Display execution info
+        }
+
+        void run() {                                                    // Main VM execution loop
+            programCounter = 0;                                         // Initialize program counter [PC = EIP] to start of program
+#if VM_DISPATCH_MODE == VM_DISPATCH_THREADED
+            RunThreaded();
+#else
+            RunTable();
+#endif
+            guestOut.Flush();                                           // Output of a program that ran off the end without HALT
+        }
+
+        void RunTable() {                                               // Table dispatch: one indirect call per instruction
+            const uint16_t* dispatch = DispatchOps();
+            while (programCounter < programLength && running) {         // Loop while within bounds and VM running
+                const Instruction& ins = program[programCounter];       // Fetch decoded instruction at current PC
+                TraceStep(ins);
+                instructionsExecuted++;
+                bool shouldIncrementPC = executeInstruction(dispatch[programCounter], ins); // Execute instruction, get PC increment flag
+                if (shouldIncrementPC) { programCounter++; }              // Check if PC should advance to next instruction (if yes increment)
+
+                if (programCounter >= programLength) {                    // Check if PC reached end of program memory
+                    VM_TRACE(TRACE_CALLS) << "Program reached end." << endl;               // Print program completion message
+                    break;                                                // Exit execution loop
                 }
             }
+        }
 
-            // ========== MATRIX OPERATIONS ==========
-            else if (opcode == "MATRIX_ALLOC_MEM") {                // Allocate memory for all matrices
-                cout << "  -> MATRIX_ALLOC_MEM: Allocating memory for matrices" << endl;
-                if (matrixAllocated) {                              // Check if matrices already allocated
-                    FreeAllMatrices();                              // Free existing matrices first
-                }
-                int totalElements = matrixSize * matrixSize;                      // Calculate total elements per matrix
-                matrixPointers["matrixA"] = AllocateVirtualMemory(totalElements * 4); // Allocate matrix A (4 bytes per element)
-                matrixPointers["matrixB"] = AllocateVirtualMemory(totalElements * 4); // Allocate matrix B
-                matrixPointers["matrixC"] = AllocateVirtualMemory(totalElements * 4); // Allocate matrix C
-                
-                registers["R1"] = matrixPointers["matrixA"]; // Store matrix A address in R1
-                registers["R2"] = matrixPointers["matrixB"]; // Store matrix B address in R2
-                registers["R3"] = matrixPointers["matrixC"]; // Store matrix C address in R3
-                
-                matrixAllocated = true;                      // Set allocation flag
-            }
-            else if (opcode == "INPUT_MATRIX_A") {                  // Input values for matrix A
-                cout << "  -> INPUT_MATRIX_A: Reading values for Matrix A" << endl;
-                cout << stringMemory["matrixALabel"];               // Display input prompt
-                InputMatrixValues(matrixPointers["matrixA"]);       // Read matrix values from user
-            }
-            else if (opcode == "INPUT_MATRIX_B") {                  // Input values for matrix B
-                cout << "  -> INPUT_MATRIX_B: Reading values for Matrix B" << endl;
-                cout << stringMemory["matrixBLabel"];               // Display input prompt
-                InputMatrixValues(matrixPointers["matrixB"]);       // Read matrix values from user
-            }
-            else if (opcode == "MATRIX_ADD_OPERATION") {            // Perform matrix addition C = A + B
-                cout << "  -> MATRIX_ADD_OPERATION: Computing C = A + B" << endl;
-                int addrA = matrixPointers["matrixA"];              // Matrix A base address
-                int addrB = matrixPointers["matrixB"];              // Matrix B base address
-                int addrC = matrixPointers["matrixC"];              // Matrix C base address
-                
-                for (int i = 0; i < matrixSize; i++) {              // Iterate through rows
-                    for (int j = 0; j < matrixSize; j++) {          // Iterate through columns
-                        int addrElemA = GetMatrixElementAddress(addrA, i, j, matrixSize); // Get A[i][j] address
-                        int addrElemB = GetMatrixElementAddress(addrB, i, j, matrixSize); // Get B[i][j] address
-                        int addrElemC = GetMatrixElementAddress(addrC, i, j, matrixSize); // Get C[i][j] address
-                        
-                        int valA = ReadVirtualMemory(addrElemA);    // Read value from matrix A
-                        int valB = ReadVirtualMemory(addrElemB);    // Read value from matrix B
-                        WriteVirtualMemory(addrElemC, valA + valB); // Store sum in matrix C
-                    }
-                }
+#if VM_HAVE_COMPUTED_GOTO
+        void RunThreaded() {                                            // Threaded code: every handler ends in its own indirect jump
+            static void* const targets[DISPATCH_COUNT] = {              // Indexed by Opcode (generated from both opcode lists)
+#define VM_OPCODE_TARGET(name, text, handler) &&threaded_##name,
+                VM_OPCODE_LIST(VM_OPCODE_TARGET)
+                VM_SUPERINSTRUCTION_LIST(VM_OPCODE_TARGET)
+                VM_JIT_OPCODE_LIST(VM_OPCODE_TARGET)
+#undef VM_OPCODE_TARGET
+            };
+            const uint16_t* dispatch = DispatchOps();
+            const int end = programLength;
+            const Instruction* ins;
+            if (programCounter >= end || !running) return;
+            ins = &program[programCounter];                             // Fetch first instruction and jump straight to its handler
+            TraceStep(*ins);
+            instructionsExecuted++;
+            goto *targets[dispatch[programCounter]];
+
+#define VM_OPCODE_THREADED(name, text, handler)                                         \
+        threaded_##name:                                                                \
+            if (Execute##handler(*ins)) { programCounter++; }                           \
+            if (programCounter >= end) {                                                \
+                VM_TRACE(TRACE_CALLS) << "Program reached end." << endl;                                 \
+                return;                                                                 \
+            }                                                                           \
+            if (!running) return;                                                       \
+            ins = &program[programCounter];                                             \
+            TraceStep(*ins);                                                            \
+            instructionsExecuted++;                                                     \
+            goto *targets[dispatch[programCounter]];
+            VM_OPCODE_LIST(VM_OPCODE_THREADED)
+            VM_SUPERINSTRUCTION_LIST(VM_OPCODE_THREADED)
+            VM_JIT_OPCODE_LIST(VM_OPCODE_THREADED)
+#undef VM_OPCODE_THREADED
+        }
+#endif
+
+        // ========== SUPERINSTRUCTIONS ==========
+        // A superinstruction runs the handlers of its components back to back on consecutive
+        // instructions, so flags, memory and traces are exactly those of the unfused sequence
+        // (each component gets its own "Executing" step line). A component that jumps ends the
+        // sequence; otherwise the PC moves to the next component.
+        template <Handler First, Handler... Rest>
+        bool ExecuteFused(const Instruction& ins) {
+            if (!(this->*First)(ins)) return false;                     // Component jumped: it has set the PC
+            if constexpr (sizeof...(Rest) == 0) {
+                return true;                                            // Fall through past the last component
+            } else {
+                if (!running) return true;                              // Component faulted: stop where the plain loop would
+                programCounter++;
+                TraceStep((&ins)[1]);
+                return ExecuteFused<Rest...>((&ins)[1]);
+            }
+        }
+
+        bool ExecuteCmpJe(const Instruction& ins)  { return ExecuteFused<&VirtualMachine::ExecuteCmp, &VirtualMachine::ExecuteJe>(ins); }
+        bool ExecuteCmpJne(const Instruction& ins) { return ExecuteFused<&VirtualMachine::ExecuteCmp, &VirtualMachine::ExecuteJne>(ins); }
+        bool ExecuteCmpJl(const Instruction& ins)  { return ExecuteFused<&VirtualMachine::ExecuteCmp, &VirtualMachine::ExecuteJl>(ins); }
+        bool ExecuteCmpJle(const Instruction& ins) { return ExecuteFused<&VirtualMachine::ExecuteCmp, &VirtualMachine::ExecuteJle>(ins); }
+        bool ExecuteCmpJge(const Instruction& ins) { return ExecuteFused<&VirtualMachine::ExecuteCmp, &VirtualMachine::ExecuteJge>(ins); }
+        bool ExecuteMovzxStore(const Instruction& ins) {
+            return ExecuteFused<&VirtualMachine::ExecuteMovzx, &VirtualMachine::ExecuteMov>(ins);
+        }
+        bool ExecuteMovzxStoreInc(const Instruction& ins) {
+            return ExecuteFused<&VirtualMachine::ExecuteMovzx, &VirtualMachine::ExecuteMov, &VirtualMachine::ExecuteInc>(ins);
+        }
+        bool ExecuteMovzxStoreIncJmp(const Instruction& ins) {
+            return ExecuteFused<&VirtualMachine::ExecuteMovzx, &VirtualMachine::ExecuteMov, &VirtualMachine::ExecuteInc, &VirtualMachine::ExecuteJmp>(ins);
+        }
+        bool ExecuteIncJmp(const Instruction& ins) { return ExecuteFused<&VirtualMachine::ExecuteInc, &VirtualMachine::ExecuteJmp>(ins); }
+
+        bool ExecuteNop(const Instruction& ins) {                       // Unknown or malformed line
+            return true;
+        }
+
+        bool ExecutePush(const Instruction& ins) {                      // Push register, variable or immediate onto the data stack
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int value = ReadOperand(ops[0]);                        // Get value from register, variable or immediate
+            if (!DataPush(value)) return Fault("data stack overflow");
+            VM_TRACE(TRACE_FULL) << "  -> PUSH: value = " << value  << ", stack size = " << DataStackSize() << endl;
+            return true;
+        }
+
+        bool ExecutePop(const Instruction& ins) {                       // Pop the data stack into a register
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int32_t value;
+            if (!DataPop(value)) return Fault("data stack underflow");
+            Reg(ops[0].value) = value;                              // Top value into the register
+            VM_TRACE(TRACE_FULL) << "  -> POP: " << OperandText(ops[0]) << " = "  << Reg(ops[0].value) << ", stack size = "  << DataStackSize() << endl;
+            return true;
+        }
+
+        // PUSHA/POPA save and restore R0..R5 (EAX, EBX, ECX, EDX, ESI, EDI); PUSHM/POPM the registers
+        // of a mask. Registers go onto the data stack in ascending order as one block, so a POPM with
+        // the same list undoes a PUSHM, and the stack matches the equivalent PUSH/POP sequences.
+        static const uint32_t PUSHA_MASK = 0x3F;                        // R0..R5
+
+        bool PushRegisters(uint32_t mask) {
+            int32_t values[32];
+            int count = 0;
+            for (int r = 0; r < VM_REGISTER_COUNT && r < 32; r++) {
+                if (mask & (1u << r)) values[count++] = Reg(r);
             }
-            else if (opcode == "DISPLAY_MATRIX_A") {                // Display matrix A contents
-                cout << "  -> DISPLAY_MATRIX_A" << endl;
-                cout << stringMemory["matrixALabel"];               // Display matrix label
-                DisplayMatrix(matrixPointers["matrixA"]);           // Show matrix values
+            if (!DataPushBlock(values, count)) return Fault("data stack overflow");
+            VM_TRACE(TRACE_FULL) << "  -> PUSH " << RegisterListText(mask) << ", stack size = " << DataStackSize() << endl;
+            return true;
+        }
+
+        bool PopRegisters(uint32_t mask) {
+            int32_t values[32];
+            int count = 0;
+            for (int r = 0; r < VM_REGISTER_COUNT && r < 32; r++) {
+                if (mask & (1u << r)) count++;
             }
-            else if (opcode == "DISPLAY_MATRIX_B") {                // Display matrix B contents
-                cout << "  -> DISPLAY_MATRIX_B" << endl;
-                cout << stringMemory["matrixBLabel"];               // Display matrix label
-                DisplayMatrix(matrixPointers["matrixB"]);           // Show matrix values
+            if (!DataPopBlock(values, count)) return Fault("data stack underflow");
+            count = 0;
+            for (int r = 0; r < VM_REGISTER_COUNT && r < 32; r++) {
+                if (mask & (1u << r)) Reg(r) = values[count++];
             }
-            else if (opcode == "DISPLAY_MATRIX_C") {                // Display matrix C contents
-                cout << "  -> DISPLAY_MATRIX_C" << endl;
-                DisplayMatrix(matrixPointers["matrixC"]);           // Show matrix values
+            VM_TRACE(TRACE_FULL) << "  -> POP " << RegisterListText(mask) << ", stack size = " << DataStackSize() << endl;
+            return true;
+        }
+
+        bool ExecutePusha(const Instruction& ins) { return PushRegisters(PUSHA_MASK); }
+        bool ExecutePopa(const Instruction& ins)  { return PopRegisters(PUSHA_MASK); }
+        bool ExecutePushm(const Instruction& ins) { return PushRegisters((uint32_t)ins.ops[0].value); }
+        bool ExecutePopm(const Instruction& ins)  { return PopRegisters((uint32_t)ins.ops[0].value); }
+
+        bool ExecuteAlloc(const Instruction& ins) {                     // Allocate memory block instruction
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int size = Reg(ops[0].value);                       // Get size from source register
+            int address = AllocateVirtualMemory(size);          // Allocate memory of specified size
+            if (address == 0) return Fault("ALLOC of " + to_string((uint32_t)size) + " bytes exceeds the heap");
+            Reg(ops[1].value) = address;                        // Store base address in destination register
+            VM_TRACE(TRACE_FULL) << "  -> ALLOC: allocated " << size << " elements, address in " << OperandText(ops[1]) << endl;
+            return true;
+        }
+
+        bool ExecuteFree(const Instruction& ins) {                      // Deallocate memory block instruction
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int address = Reg(ops[0].value);                    // Get base address from register (block size is known to the heap)
+            if (FreeVirtualMemory(address)) {                   // Free the memory block
+                VM_TRACE(TRACE_FULL) << "  -> FREE: freed memory at address in " << OperandText(ops[0]) << endl;
             }
-            else if (opcode == "FREE_ALL_MATRICES") {               // Deallocate all matrix memory
-                cout << "  -> FREE_ALL_MATRICES" << endl;
-                FreeAllMatrices();                                  // Free matrix memory
+            return true;
+        }
+
+        bool ExecuteHeapStats(const Instruction& ins) {                 // Print allocator statistics (guest output: the program asked for them)
+            HeapStats stats = heap.Stats();
+            guestOut << "HEAP: live " << stats.liveBytes << " bytes in " << stats.liveBlocks << " blocks, peak "
+                 << stats.peakLiveBytes << ", free " << stats.freeBytes << " bytes in " << stats.freeBlocks
+                 << " ranges (largest " << stats.largestFreeBlock << "), heap " << stats.heapBytes
+                 << " bytes, fragmentation " << (int)(stats.fragmentation * 100) << "%" << '\n';
+            return true;
+        }
+
+        bool ExecuteStore(const Instruction& ins) {                     // Store value to memory instruction
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int address = EffectiveAddress(ops[0]);             // Direct [address] or address held in a register
+            int value = ReadOperand(ops[1]);                    // Register or immediate value
+            WriteVirtualMemory(address, value, ops[0].width);   // Write value to memory address (DWORD unless a size was given)
+            VM_TRACE(TRACE_FULL) << "  -> STORE: value " << value << " to address 0x" << hex << address << dec << endl;
+            return true;
+        }
+
+        bool ExecuteLoad(const Instruction& ins) {                      // Load value from memory to register
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int address = EffectiveAddress(ops[1]);             // Direct [address] or address held in a register
+            int value = ReadVirtualMemory(address, ops[1].width); // Read value from memory (DWORD unless a size was given)
+            Reg(ops[0].value) = value;                          // Store value in destination register
+            VM_TRACE(TRACE_FULL) << "  -> LOAD: from address 0x" << hex << address << " to " << OperandText(ops[0]) << " = " << value << dec << endl;
+            return true;
+        }
+
+        bool ExecuteGetElementAddr(const Instruction& ins) {            // Calculate matrix element address
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int baseAddr = Reg(ops[1].value);                   // Matrix base address
+            int row = Reg(ops[2].value);                        // Row index
+            int col = Reg(ops[3].value);                        // Column index
+            int size = Reg(ops[4].value);                       // Matrix dimension size
+            int elementAddr = GetMatrixElementAddress(baseAddr, row, col, size); // Calculate address
+            Reg(ops[0].value) = elementAddr;                    // Store calculated address in destination register
+            VM_TRACE(TRACE_FULL) << "  -> GET_ELEMENT_ADDR: [" << row << "][" << col << "] -> 0x" << hex << elementAddr << dec << endl;
+            return true;
+        }
+
+        bool ExecuteMatrixAllocMem(const Instruction& ins) {            // Allocate memory for all matrices
+            VM_TRACE(TRACE_FULL) << "  -> MATRIX_ALLOC_MEM: Allocating memory for matrices" << endl;
+            int size = matrixSize;                              // FreeAllMatrices() resets matrixSize
+            if (matrixAllocated) {                              // Check if matrices already allocated
+                FreeAllMatrices();                              // Free existing matrices first
             }
-            else if (opcode == "CHECK_ALLOCATED") {                 // Check if matrices are allocated
-                cout << "  -> CHECK_ALLOCATED" << endl;
-                if (!matrixAllocated) {                             // If no matrices allocated
-                    cout << stringMemory["noMatrixMsg"];            // Display error message
-                }
+            int64_t bytes = (int64_t)size * size * 4;           // 4 bytes per element, in 64 bits so no size can overflow
+            if (size <= 0 || bytes > heap.MaxBlockSize()) {
+                return Fault("matrix size " + to_string(size) + " is out of range");
             }
-            else if (opcode == "STORE_MATRIX_SIZE") {               // Store matrix size from R0
-                cout << "  -> STORE_MATRIX_SIZE" << endl;
-                matrixSize = registers["R0"];                       // Set matrix size from register R0 [EAX]
-                cout << "  -> Matrix size set to " << matrixSize << "x" << matrixSize << endl;
+            matrixSize = size;
+            matrixPointers["matrixA"] = AllocateVirtualMemory((int)bytes); // Allocate matrix A
+            matrixPointers["matrixB"] = AllocateVirtualMemory((int)bytes); // Allocate matrix B
+            matrixPointers["matrixC"] = AllocateVirtualMemory((int)bytes); // Allocate matrix C
+            if (matrixPointers["matrixA"] == 0 || matrixPointers["matrixB"] == 0 || matrixPointers["matrixC"] == 0) {
+                FreeAllMatrices();                              // Release the ones that did fit (0 entries are skipped)
+                return Fault("MATRIX_ALLOC_MEM of 3 x " + to_string(bytes) + " bytes exceeds the heap");
             }
 
-            // ========== I/O OPERATIONS ==========
-            else if (opcode == "PRINT_STR") {                       // Print string from string memory OR buffer
-                if (tokens.size() > 1) {
-                    string strName = tokens[1];
-                    
-                    // Check if it's a predefined string message
-                    if (stringMemory.find(strName) != stringMemory.end()) {
-                        cout << stringMemory[strName];              // Output predefined string
-                    }
-                    // Check if it's a string buffer (read from virtual memory)
-                    else if (stringBuffers.find(strName) != stringBuffers.end()) {
-                        int bufferAddr = stringBuffers[strName];
-                        string str = ReadStringFromMemory(bufferAddr);
-                        cout << str;                                // Output string from memory
-                        cout << "  -> Printed from buffer '" << strName << "': '" << str << "'" << endl;
-                    }
-                    else {
-                        cout << "  -> ERROR: String '" << strName << "' not found!" << endl;
-                    }
+            Reg(1) = matrixPointers["matrixA"];          // Store matrix A address in R1
+            Reg(2) = matrixPointers["matrixB"];          // Store matrix B address in R2
+            Reg(3) = matrixPointers["matrixC"];          // Store matrix C address in R3
+
+            matrixAllocated = true;                      // Set allocation flag
+            return true;
+        }
+
+        bool ExecuteInputMatrixA(const Instruction& ins) {              // Input values for matrix A
+            VM_TRACE(TRACE_FULL) << "  -> INPUT_MATRIX_A: Reading values for Matrix A" << endl;
+            guestOut << stringMemory["matrixALabel"];           // Display input prompt
+            InputMatrixValues(matrixPointers["matrixA"]);       // Read matrix values from user
+            return true;
+        }
+
+        bool ExecuteInputMatrixB(const Instruction& ins) {              // Input values for matrix B
+            VM_TRACE(TRACE_FULL) << "  -> INPUT_MATRIX_B: Reading values for Matrix B" << endl;
+            guestOut << stringMemory["matrixBLabel"];           // Display input prompt
+            InputMatrixValues(matrixPointers["matrixB"]);       // Read matrix values from user
+            return true;
+        }
+
+        bool ExecuteMatrixAddOperation(const Instruction& ins) {        // Perform matrix addition C = A + B
+            VM_TRACE(TRACE_FULL) << "  -> MATRIX_ADD_OPERATION: Computing C = A + B" << endl;
+            int addrA = matrixPointers["matrixA"];              // Matrix A base address
+            int addrB = matrixPointers["matrixB"];              // Matrix B base address
+            int addrC = matrixPointers["matrixC"];              // Matrix C base address
+
+            for (int i = 0; i < matrixSize; i++) {              // Iterate through rows
+                for (int j = 0; j < matrixSize; j++) {          // Iterate through columns
+                    int addrElemA = GetMatrixElementAddress(addrA, i, j, matrixSize); // Get A[i][j] address
+                    int addrElemB = GetMatrixElementAddress(addrB, i, j, matrixSize); // Get B[i][j] address
+                    int addrElemC = GetMatrixElementAddress(addrC, i, j, matrixSize); // Get C[i][j] address
+
+                    int valA = ReadVirtualMemory(addrElemA);    // Read value from matrix A
+                    int valB = ReadVirtualMemory(addrElemB);    // Read value from matrix B
+                    WriteVirtualMemory(addrElemC, valA + valB); // Store sum in matrix C
                 }
             }
-            else if (opcode == "READ_INT") {                        // Read integer input from user
-                if (tokens.size() > 1 && IsRegister(tokens[1])) {
-                    cout << "  Enter value for " << tokens[1] << ": ";
-                    string input;
-                    cin >> input;                                   // Read user input
-                    try {
-                        registers[tokens[1]] = stoi(input);         // Try to convert to integer
-                        cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << " (numeric)" << endl;
-                    } catch (...) {                                 // If conversion fails
-                        if (!input.empty()) {                       // If input not empty
-                            registers[tokens[1]] = (int)input[0];   // Store ASCII value of first character
-                            cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << " (ASCII: '" << (char)registers[tokens[1]] << "')" << endl;
-                        } else {
-                            registers[tokens[1]] = 0;               // Store 0 for empty input
-                            cout << "  -> " << tokens[1] << " = 0 (empty input)" << endl;
-                        }
-                    }
+            return true;
+        }
+
+        bool ExecuteDisplayMatrixA(const Instruction& ins) {            // Display matrix A contents
+            VM_TRACE(TRACE_FULL) << "  -> DISPLAY_MATRIX_A" << endl;
+            guestOut << stringMemory["matrixALabel"];           // Display matrix label
+            DisplayMatrix(matrixPointers["matrixA"]);           // Show matrix values
+            return true;
+        }
+
+        bool ExecuteDisplayMatrixB(const Instruction& ins) {            // Display matrix B contents
+            VM_TRACE(TRACE_FULL) << "  -> DISPLAY_MATRIX_B" << endl;
+            guestOut << stringMemory["matrixBLabel"];           // Display matrix label
+            DisplayMatrix(matrixPointers["matrixB"]);           // Show matrix values
+            return true;
+        }
+
+        bool ExecuteDisplayMatrixC(const Instruction& ins) {            // Display matrix C contents
+            VM_TRACE(TRACE_FULL) << "  -> DISPLAY_MATRIX_C" << endl;
+            DisplayMatrix(matrixPointers["matrixC"]);           // Show matrix values
+            return true;
+        }
+
+        bool ExecuteFreeAllMatrices(const Instruction& ins) {           // Deallocate all matrix memory
+            VM_TRACE(TRACE_FULL) << "  -> FREE_ALL_MATRICES" << endl;
+            FreeAllMatrices();                                  // Free matrix memory
+            return true;
+        }
+
+        bool ExecuteCheckAllocated(const Instruction& ins) {            // Check if matrices are allocated
+            VM_TRACE(TRACE_FULL) << "  -> CHECK_ALLOCATED" << endl;
+            if (!matrixAllocated) {                             // If no matrices allocated
+                guestOut << stringMemory["noMatrixMsg"];        // Display error message
+            }
+            return true;
+        }
+
+        bool ExecuteStoreMatrixSize(const Instruction& ins) {           // Store matrix size from R0
+            VM_TRACE(TRACE_FULL) << "  -> STORE_MATRIX_SIZE" << endl;
+            matrixSize = Reg(0);                                // Set matrix size from register R0 [EAX]
+            VM_TRACE(TRACE_FULL) << "  -> Matrix size set to " << matrixSize << "x" << matrixSize << endl;
+            return true;
+        }
+
+        bool ExecutePrintStr(const Instruction& ins) {                  // Print string from string memory OR buffer
+            const Operand* ops = ins.ops;                               // Decoded operands
+            const ResolvedSymbol& symbol = symbols[ops[0].value];
+
+            // Check if it's a predefined string message
+            if (symbol.text) {
+                guestOut << *symbol.text;                       // Output predefined string
+            }
+            // Check if it's a string buffer (read from virtual memory)
+            else if (symbol.isBuffer) {                         // Straight from the guest pages, no copy
+                int address = symbol.bufferAddress;
+                VisitGuestString(address, [&](const char* text, size_t length) { guestOut.Write(text, length); });
+                if (Tracing(TRACE_FULL)) {
+                    ostream& trace = TraceStream();
+                    trace << "  -> Printed from buffer '" << OperandText(ops[0]) << "': '";
+                    VisitGuestString(address, [&](const char* text, size_t length) { trace.write(text, (streamsize)length); });
+                    trace << "'" << endl;
                 }
             }
-            else if (opcode == "READ_STRING") {                     // Read string input from user
-                if (tokens.size() > 1 && IsRegister(tokens[1])) {
-                    cout << "  Enter string: ";
-                    string input;
-                    
-                    // Clear any leftover newline from previous cin operations
-                    if (cin.peek() == '\n') { cin.ignore();} 
-
-                    getline(cin, input);                            // Read entire line including spaces
-                    int bufferAddress = registers["R3"];            // Get buffer address from register R3 (convention: R3 holds target buffer address)
-                    WriteStringToMemory(bufferAddress, input);      // Write string to memory (byte by byte)
-                    registers[tokens[1]] = input.length();          // Store length in the specified register (usually R0)
-                    
-                    cout << "  -> READ_STRING: stored '" << input << "' at address 0x" << hex << bufferAddress << dec << ", length = " << input.length() << endl;
-                    // Debug: Verify what was written to memory
-                    cout << "  -> DEBUG: Reading back from memory: '"<< ReadStringFromMemory(bufferAddress) << "'" << endl;
-                    for (int i = 0; i < input.length(); i++) {
-                        cout << "  -> Memory[0x" << hex << (bufferAddress + i) << dec   << "] = " << ReadVirtualMemory(bufferAddress + i)  << " ('" << (char)ReadVirtualMemory(bufferAddress + i) << "')" << endl;
-                    }
+            else {
+                VM_TRACE(TRACE_ERRORS) << "  -> ERROR: String '" << OperandText(ops[0]) << "' not found!" << endl;
+            }
+            return true;
+        }
+
+        bool ExecuteReadInt(const Instruction& ins) {                   // Read integer input from user
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int& reg = Reg(ops[0].value);                       // Destination register
+            string regName = OperandText(ops[0]);
+            VM_TRACE(TRACE_FULL) << "  Enter value for " << regName << ": ";
+            string input;
+            guestOut.Flush();                                   // Prompt must be visible before blocking on input
+            *guestIn >> input;                                  // Read user input
+            if (InputExhausted()) return true;
+            try {
+                reg = stoi(input);                              // Try to convert to integer
+                VM_TRACE(TRACE_FULL) << "  -> " << regName << " = " << reg << " (numeric)" << endl;
+            } catch (...) {                                     // If conversion fails
+                if (!input.empty()) {                           // If input not empty
+                    reg = (int)input[0];                        // Store ASCII value of first character
+                    VM_TRACE(TRACE_FULL) << "  -> " << regName << " = " << reg << " (ASCII: '" << (char)reg << "')" << endl;
+                } else {
+                    reg = 0;                                    // Store 0 for empty input
+                    VM_TRACE(TRACE_FULL) << "  -> " << regName << " = 0 (empty input)" << endl;
                 }
             }
-            else if (opcode == "WRITE_INT") {                       // Output integer value
-                if (tokens.size() > 1 && IsRegister(tokens[1])) {
-                    cout << "  WRITE_INT " << tokens[1] << endl;
-                    cout << registers[tokens[1]];                   // Print register value
+            return true;
+        }
+
+        bool ExecuteReadString(const Instruction& ins) {                // Read string input from user
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  Enter string: ";
+
+            guestOut.Flush();                                   // Prompt must be visible before blocking on input
+            // Clear any leftover newline from previous cin operations
+            if (guestIn->peek() == '\n') { guestIn->ignore();}
+
+            getline(*guestIn, inputLine);                       // Read entire line including spaces (reused buffer: no per-line allocation)
+            if (InputExhausted()) return true;
+            int bufferAddress = Reg(3);                         // Get buffer address from register R3 (convention: R3 holds target buffer address)
+            int capacity = StringLimit(bufferAddress) - 1;      // Room left for the NUL in the target buffer
+            int length = (int)inputLine.length();
+            if (length > capacity) {                            // Long line: keep what fits instead of overrunning the next block
+                VM_TRACE(TRACE_ERRORS) << "  -> ERROR: READ_STRING input of " << length << " bytes truncated to " << capacity << " at " << AddressText(bufferAddress) << endl;
+                length = capacity;
+            }
+            virtualMemory.WriteBlock(bufferAddress, (const uint8_t*)inputLine.data(), length); // One bulk copy, page by page
+            virtualMemory.Write(bufferAddress + length, 0, BYTE_SIZE);                         // Null terminator
+            Reg(ops[0].value) = length;                         // Store length in the specified register (usually R0)
+
+            VM_TRACE(TRACE_FULL) << "  -> READ_STRING: stored '" << inputLine.substr(0, length) << "' at address 0x" << hex << bufferAddress << dec << ", length = " << length << endl;
+            if (Tracing(TRACE_DEBUG)) DumpMemory(bufferAddress, length);        // Verify what was written to memory
+            return true;
+        }
+
+        void DumpMemory(int address, int length) {                      // TRACE_DEBUG: one line per guest byte
+            for (int i = 0; i < length; i++) {
+                int value = ReadVirtualMemory(address + i, BYTE_SIZE);
+                TraceStream() << "  -> Memory[0x" << hex << (address + i) << dec << "] = " << value << " ('" << (char)value << "')" << endl;
+            }
+        }
+
+        // ========== STRING INSTRUCTIONS ==========
+        // STRLEN, STRCPY, STRCAT, STRCMP and STRREV handle NUL-terminated strings in guest memory in
+        // one step (memchr/memcpy over whole pages) instead of a MOVZX/MOV/INC/CMP/Jcc loop per byte.
+        // Operands are string buffer names or registers holding an address. R0 receives the length
+        // of the resulting string, with ZF/SF set from it as by MOV. STRCMP instead leaves the index
+        // of the first difference in R0 and the flags of a CMP between the two (unsigned) bytes
+        // there, so JE/JNE test equality and JB/JA the order. A destination that starts a heap block
+        // must have room for the result and its terminator; otherwise the guest faults.
+        static const int MAX_STRING_LENGTH = 1 << 16;                   // Longest string scanned for its terminator
+
+        static string AddressText(int address) {                        // "0x1f40"
+            ostringstream text;
+            text << "0x" << hex << address;
+            return text.str();
+        }
+
+        int StringLimit(int address) const {                            // Longest string read at address: its heap block's requested size, if it starts one
+            int capacity = heap.BlockSize(address);
+            return (capacity > 0) ? capacity : MAX_STRING_LENGTH;
+        }
+
+        template <typename Emit>
+        int VisitGuestString(int address, Emit emit) {                  // emit(text, length) for each in-page run of the string; returns its length
+            int limit = StringLimit(address), length = 0;
+            while (length < limit) {
+                int chunk = limit - length;
+                const uint8_t* bytes = virtualMemory.Span(address + length, chunk);
+                if (!bytes) break;                                      // Unmapped page: reads as NUL
+                const uint8_t* end = (const uint8_t*)memchr(bytes, 0, chunk);
+                int run = end ? (int)(end - bytes) : chunk;
+                if (run > 0) emit((const char*)bytes, (size_t)run);
+                length += run;
+                if (end) break;
+            }
+            return length;
+        }
+
+        bool StringAddress(const Operand& op, int& address) {           // False (after a fault) for a name that is not a buffer
+            if (op.kind == OPND_REG) {
+                address = Reg(op.value);
+                return true;
+            }
+            if (!symbols[op.value].isBuffer) return Fault("'" + OperandText(op) + "' is not a string buffer");
+            address = symbols[op.value].bufferAddress;
+            return true;
+        }
+
+        bool StringLength(int address, int& length) {                   // False (after a fault) if there is no terminator
+            length = virtualMemory.FindByte(address, 0, MAX_STRING_LENGTH);
+            if (length < 0) return Fault("unterminated string at address " + AddressText(address));
+            return true;
+        }
+
+        bool StringFits(int address, int length) {                      // False (after a fault) if length + NUL overflows the block
+            int capacity = heap.BlockSize(address);                     // 0: not the start of a heap block, nothing to check
+            if (capacity > 0 && length >= capacity) {
+                return Fault("string of " + to_string(length) + " bytes overflows the " + to_string(capacity) + "-byte buffer at address " + AddressText(address));
+            }
+            return true;
+        }
+
+        bool StringResult(const Instruction& ins, int length) {         // R0 = length, ZF/SF from it
+            Reg(0) = length;
+            SetResultFlags(length);
+            VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << ": R0 = " << length << endl;
+            return true;
+        }
+
+        bool ExecuteStrlen(const Instruction& ins) {                    // R0 = length of the string
+            int address, length;
+            if (!StringAddress(ins.ops[0], address) || !StringLength(address, length)) return false;
+            return StringResult(ins, length);
+        }
+
+        bool ExecuteStrcpy(const Instruction& ins) {                    // Copy the source string (and its NUL) to the destination
+            int dst, src, length;
+            if (!StringAddress(ins.ops[0], dst) || !StringAddress(ins.ops[1], src) || !StringLength(src, length) || !StringFits(dst, length)) return false;
+            virtualMemory.Copy(dst, src, length + 1);
+            return StringResult(ins, length);
+        }
+
+        bool ExecuteStrcat(const Instruction& ins) {                    // Append the source string to the destination string
+            int dst, src, dstLength, srcLength;
+            if (!StringAddress(ins.ops[0], dst) || !StringAddress(ins.ops[1], src) ||
+                !StringLength(dst, dstLength) || !StringLength(src, srcLength) || !StringFits(dst, dstLength + srcLength)) return false;
+            virtualMemory.Copy(dst + dstLength, src, srcLength + 1);
+            return StringResult(ins, dstLength + srcLength);
+        }
+
+        bool ExecuteStrrev(const Instruction& ins) {                    // Destination = source reversed (may be the same buffer)
+            int dst, src, length;
+            if (!StringAddress(ins.ops[0], dst) || !StringAddress(ins.ops[1], src) || !StringLength(src, length) || !StringFits(dst, length)) return false;
+            stringScratch.resize(length + 1);
+            virtualMemory.ReadBlock(src, stringScratch.data(), length + 1);
+            reverse(stringScratch.begin(), stringScratch.begin() + length);
+            virtualMemory.WriteBlock(dst, stringScratch.data(), length + 1);
+            return StringResult(ins, length);
+        }
+
+        bool ExecuteStrcmp(const Instruction& ins) {                    // Compare two strings like a CMP of their first differing bytes
+            int first, second, firstLength, secondLength;
+            if (!StringAddress(ins.ops[0], first) || !StringAddress(ins.ops[1], second) ||
+                !StringLength(first, firstLength) || !StringLength(second, secondLength)) return false;
+            int compared = min(firstLength, secondLength) + 1;          // Up to and including the shorter string's NUL
+            stringScratch.resize(2 * compared);
+            virtualMemory.ReadBlock(first, stringScratch.data(), compared);
+            virtualMemory.ReadBlock(second, stringScratch.data() + compared, compared);
+            int index = (int)(mismatch(stringScratch.begin(), stringScratch.begin() + compared, stringScratch.begin() + compared).first - stringScratch.begin());
+            int left = (index < compared) ? stringScratch[index] : 0;   // Equal strings compare their NULs
+            int right = (index < compared) ? stringScratch[compared + index] : 0;
+            if (index == compared) index = firstLength;
+            Reg(0) = index;
+            SetArithmeticFlags(FLAGS_SUB, left, right, left - right);
+            VM_TRACE(TRACE_FULL) << "  -> STRCMP: R0 = " << index << ", ZF=" << ZeroFlag() << " CF=" << CarryFlag() << endl;
+            return true;
+        }
+
+        // ========== STRING PRIMITIVES ==========
+        // x86 byte string instructions on R4 = ESI, R5 = EDI, R2 = ECX and the low byte of R0 = AL.
+        // Each steps its pointers by +1, or by -1 after STD (direction flag). With a REP prefix
+        // MOVSB/STOSB/LODSB run ECX steps as one bulk operation (memmove, memset, one load) and
+        // leave ECX = 0; ECX above MAX_REP_COUNT is a fault rather than a 4 GiB copy. SCASB
+        // (CMP AL, [EDI]) and CMPSB (CMP [ESI], [EDI]) set the flags of their last compare; under
+        // REPE/REPNE they scan page-sized blocks (memchr for a forward REPNE SCASB) until the
+        // condition fails or ECX runs out. A scan still going after MAX_REP_COUNT steps is the same
+        // fault, so the ECX = -1 strlen idiom works for any string shorter than the cap.
+        static const int MAX_REP_COUNT = 1 << 24;                       // Most steps of one REP instruction (16 MiB)
+
+        uint32_t RepCount(const Instruction& ins) { return (ins.operandCount > 0) ? (uint32_t)Reg(2) : 1; } // ECX with a prefix, otherwise 1
+        int RepPrefixOf(const Instruction& ins) const { return (ins.operandCount > 0) ? ins.ops[0].value : REP_NONE; }
+        int StringStep() const { return DF ? -1 : 1; }
+        int Advance(int address, uint32_t steps) const { return (int)((uint32_t)address + steps * (uint32_t)StringStep()); }
+        int BlockStart(int address, int count) const { return DF ? address - count + 1 : address; } // Lowest address of count steps
+
+        bool BulkCount(const Instruction& ins, int& count) {            // RepCount of MOVSB/STOSB; false (after a fault) if too large
+            uint32_t steps = RepCount(ins);
+            if (steps > (uint32_t)MAX_REP_COUNT) return Fault("REP count " + to_string(steps) + " exceeds " + to_string(MAX_REP_COUNT));
+            count = (int)steps;
+            return true;
+        }
+
+        void FinishRep(const Instruction& ins, uint32_t steps) {        // ECX -= steps (prefixed forms only)
+            if (ins.operandCount > 0) Reg(2) = (int)((uint32_t)Reg(2) - steps);
+            VM_TRACE(TRACE_FULL) << "  -> " << DisassembleInstruction(ins) << ": " << steps << " step(s), ESI=0x" << hex << Reg(4)
+                 << " EDI=0x" << Reg(5) << dec << " ECX=" << Reg(2) << endl;
+        }
+
+        bool ExecuteMovsb(const Instruction& ins) {                     // [EDI] = [ESI]
+            int count;
+            if (!BulkCount(ins, count)) return false;
+            int src = Reg(4), dst = Reg(5), step = StringStep();
+            int ahead = DF ? src - dst : dst - src;                     // Destination runs ahead of the source by this much
+            if (ahead > 0 && ahead < count) {                           // Overlap that re-reads copied bytes: keep the byte order
+                for (int i = 0; i < count; i++) {
+                    WriteVirtualMemory(dst + i * step, ReadVirtualMemory(src + i * step, BYTE_SIZE), BYTE_SIZE);
                 }
+            } else if (count > 0) {
+                virtualMemory.Copy(BlockStart(dst, count), BlockStart(src, count), count);
             }
-            else if (opcode == "READ_CHAR") {                       // Read a single character from user
-                char c;
-                cin >> c;
-            }
-            else if (opcode == "Crlf") {                            // Print newline (Irvine32 equivalent)
-                cout << endl;
-            }
-
-            // ========== ARITHMETIC INSTRUCTIONS ========== 
-            else if (opcode == "ADD") {                             // Add two registers or a variable into register
-                if (tokens.size() > 2 && IsRegister(tokens[1])) {
-                    cout << "  ADD " << tokens[1] << ", " << tokens[2] << endl;
-                    int oldValue = registers[tokens[1]];            // Store original value for overflow detection
-                    int operand2;                                   // A var to store the second operand (register or var)
-                    
-                    // Parse second operand (register, variable, or immediate)
-                    if (IsRegister(tokens[2])) { operand2 = registers[tokens[2]]; }               // operand 2 is a register
-                    else if (IsVariable(tokens[2])) { operand2 = GetVariableValue(tokens[2]);}    // operand 2 is a variable
-                    else { operand2 = stoi(tokens[2]); }                                          // operand 2 is a immediate value
-
-                    registers[tokens[1]] += operand2;   // Add source to destination register
-                    cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << endl;
-                
-                    // Set status flags for ADD operation
-                    int result = registers[tokens[1]];
-                    ZF = (result == 0);                                             // Zero Flag: result is zero
-                    SF = (result < 0);                                              // Sign Flag: result is negative
-                    OF = (oldValue > 0 && operand2 > 0 && result < 0) ||            // Positive overflow
-                        (oldValue < 0 && operand2 < 0 && result > 0);               // Negative overflow
-                    CF = false;                                                     // No carry flag for signed arithmetic
-                    
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << " CF=" << CF << endl;
-                }
+            Reg(4) = Advance(src, count);
+            Reg(5) = Advance(dst, count);
+            FinishRep(ins, count);
+            return true;
+        }
+
+        bool ExecuteStosb(const Instruction& ins) {                     // [EDI] = AL
+            int count;
+            if (!BulkCount(ins, count)) return false;
+            virtualMemory.Fill(BlockStart(Reg(5), count), count, (uint8_t)Reg(0));
+            Reg(5) = Advance(Reg(5), count);
+            FinishRep(ins, count);
+            return true;
+        }
+
+        bool ExecuteLodsb(const Instruction& ins) {                     // AL = [ESI]; the rest of R0 is kept
+            uint32_t count = RepCount(ins);
+            if (count > 0) {                                            // Only the last byte loaded survives
+                int last = ReadVirtualMemory(Advance(Reg(4), count - 1), BYTE_SIZE);
+                Reg(0) = (int)(((uint32_t)Reg(0) & ~0xFFu) | (uint32_t)last);
             }
-            else if (opcode == "SUB") {                             // Subtract two registers or a var into register
-                if (tokens.size() > 2 && IsRegister(tokens[1])) {   // Overall: Ensure instruction has proper "OP REGISTER, REGISTER" format
-                    cout << "  SUB " << tokens[1] << ", " << tokens[2] << endl;
-                    int oldValue = registers[tokens[1]];            // Store original value for overflow detection
-                    int operand2;                                   // A var to store the second operand (register or var)
-                    
-                    // Parse second operand (register, variable, or immediate)
-                    if (IsRegister(tokens[2])) { operand2 = registers[tokens[2]]; }             // operand 2 is a register
-                    else if (IsVariable(tokens[2])) { operand2 = GetVariableValue(tokens[2]);}  // operand 2 is a variable
-                    else { operand2 = stoi(tokens[2]); }                                        // operand 2 is a immediate value
-                    
-                    registers[tokens[1]] -= operand2;   // Subtract source from destination
-                    cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << endl;
-                    
-                    // Set status flags for SUB operation
-                    int result = registers[tokens[1]];
-                    ZF = (result == 0);                             // Zero Flag: result is zero
-                    SF = (result < 0);                              // Sign Flag: result is negative
-                    OF = (oldValue >= 0 && operand2 < 0 && result < 0) || (oldValue < 0 && operand2 > 0 && result > 0); // Overflow cases
-                    CF = false;                                     // No carry flag for signed arithmetic
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << " CF=" << CF << endl;
+            Reg(4) = Advance(Reg(4), count);
+            FinishRep(ins, count);
+            return true;
+        }
+
+        bool ScanSteps(const Instruction& ins, int src, int dst, const uint8_t* al, uint32_t& steps) { // Steps SCASB (al set) / CMPSB take; false after a fault
+            const int BLOCK = (int)PagedMemory::PAGE_SIZE;
+            uint32_t count = RepCount(ins), done = 0;
+            uint32_t limit = min<uint32_t>(count, MAX_REP_COUNT);      // Never scan more than the cap, whatever ECX says
+            bool whileEqual = (RepPrefixOf(ins) != REP_WHILE_NOT_EQUAL); // REP acts as REPE; without a prefix count is 1
+            while (done < limit) {
+                int n = (int)min<uint32_t>(limit - done, BLOCK);
+                int right = Advance(dst, done);
+                if (al && !whileEqual && !DF) {                         // REPNE SCASB forward: memchr for AL
+                    int found = virtualMemory.FindByte(right, *al, n);
+                    if (found >= 0) { steps = done + found + 1; return true; }
+                    done += n;
+                    continue;
                 }
-            }
-            else if (opcode == "IDIV") {                            // Division
-                // Signed division: EDX:EAX / divisor
-                if (tokens.size() > 1) {
-                    cout << "  IDIV " << tokens[1] << endl;
-                    int divisor;
-                    
-                    // Parse divisor (register, variable, or immediate)
-                    if (IsRegister(tokens[1])) { divisor = registers[tokens[1]]; }              // divisor is a register
-                    else if (IsVariable(tokens[1])) { divisor = GetVariableValue(tokens[1]); }  // divisor is a variable
-                    else {  divisor = stoi(tokens[1]); }                                        // divisor is a immediate value
-                    
-                    if (divisor == 0) {
-                         cout << "  -> ERROR: Division by zero!" << endl;
-                        
-                        ZF = false; SF = false; OF = true; CF = true;
-                    } else {
-                        // Dividend is in R0:R1 (64-bit), result in R0, remainder in R1
-                        long long dividend = (long long)registers["R0"] | ((long long)registers["R1"] << 32);
-                        registers["R0"] = (int)(dividend / divisor);  // Quotient
-                        registers["R1"] = (int)(dividend % divisor);  // Remainder
-                        
-                        cout << "  -> R0 (quotient) = " << registers["R0"] << endl;
-                        cout << "  -> R1 (remainder) = " << registers["R1"] << endl;
-                        
-                        // Set flags for IDIV
-                        ZF = (registers["R0"] == 0);
-                        SF = (registers["R0"] < 0);
-                        OF = false;  // IDIV doesn't typically set overflow flag
-                        CF = false;  // IDIV doesn't typically set carry flag
-                        
-                        cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << " CF=" << CF << endl;
-                    }
+                stringScratch.resize(2 * n);
+                uint8_t* dstBytes = stringScratch.data() + n;
+                virtualMemory.ReadBlock(BlockStart(right, n), dstBytes, n);
+                if (!al) virtualMemory.ReadBlock(BlockStart(Advance(src, done), n), stringScratch.data(), n);
+                for (int i = 0; i < n; i++) {
+                    int at = DF ? n - 1 - i : i;                        // Blocks are stored low to high
+                    uint8_t left = al ? *al : stringScratch[at];
+                    if ((left == dstBytes[at]) != whileEqual) { steps = done + i + 1; return true; }
                 }
+                done += n;
             }
-            else if (opcode == "IMUL") {                            // Multiplication
-                // Signed multiplication
-                if (tokens.size() > 2 && IsRegister(tokens[1])) {
-                    cout << "  IMUL " << tokens[1] << ", " << tokens[2] << endl;
-                    int operand2;
-                    
-                    // Parse second operand (register, variable, or immediate)
-                    if (IsRegister(tokens[2])) { operand2 = registers[tokens[2]]; } 
-                    else if (IsVariable(tokens[2])) { operand2 = GetVariableValue(tokens[2]);}
-                    else { operand2 = stoi(tokens[2]); }
-                    
-                    long long result = (long long)registers[tokens[1]] * (long long)operand2;
-                    registers[tokens[1]] = (int)result;              // Store lower 32 bits
-                    cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << endl;
-                    
-                    // Set flags for IMUL
-                    ZF = (registers[tokens[1]] == 0);
-                    SF = (registers[tokens[1]] < 0);
-                    // For IMUL, OF and CF are set if the result exceeds 32-bit signed range
-                    OF = CF = (result > INT_MAX || result < INT_MIN);
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << " CF=" << CF << endl;
-                }
+            if (count > limit) return Fault("REP count " + to_string(count) + " exceeds " + to_string(MAX_REP_COUNT));
+            steps = count;
+            return true;
+        }
+
+        void SetScanFlags(int left, int right) { SetArithmeticFlags(FLAGS_SUB, left, right, left - right); } // CMP left, right (bytes)
+
+        bool ExecuteScasb(const Instruction& ins) {                     // CMP AL, [EDI]
+            uint8_t al = (uint8_t)Reg(0);
+            int dst = Reg(5);
+            uint32_t steps;
+            if (!ScanSteps(ins, 0, dst, &al, steps)) return false;
+            if (steps > 0) SetScanFlags(al, ReadVirtualMemory(Advance(dst, steps - 1), BYTE_SIZE));
+            Reg(5) = Advance(dst, steps);
+            FinishRep(ins, steps);
+            return true;
+        }
+
+        bool ExecuteCmpsb(const Instruction& ins) {                     // CMP [ESI], [EDI]
+            int src = Reg(4), dst = Reg(5);
+            uint32_t steps;
+            if (!ScanSteps(ins, src, dst, nullptr, steps)) return false;
+            if (steps > 0) SetScanFlags(ReadVirtualMemory(Advance(src, steps - 1), BYTE_SIZE), ReadVirtualMemory(Advance(dst, steps - 1), BYTE_SIZE));
+            Reg(4) = Advance(src, steps);
+            Reg(5) = Advance(dst, steps);
+            FinishRep(ins, steps);
+            return true;
+        }
+
+        bool ExecuteStd(const Instruction& ins) {                       // Direction flag: string primitives step down
+            DF = true;
+            VM_TRACE(TRACE_FULL) << "  -> DF = 1" << endl;
+            return true;
+        }
+
+        bool ExecuteCld(const Instruction& ins) {                       // Direction flag: string primitives step up
+            DF = false;
+            VM_TRACE(TRACE_FULL) << "  -> DF = 0" << endl;
+            return true;
+        }
+
+        bool ExecuteWriteInt(const Instruction& ins) {                  // Output integer value
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  WRITE_INT " << OperandText(ops[0]) << endl;
+            guestOut << Reg(ops[0].value);                      // Print register value
+            return true;
+        }
+
+        bool ExecuteReadChar(const Instruction& ins) {                  // Read a single character from user
+            char c;
+            guestOut.Flush();                                   // Prompt must be visible before blocking on input
+            *guestIn >> c;
+            InputExhausted();
+            return true;
+        }
+
+        bool ExecuteCrlf(const Instruction& ins) {                      // Print newline (Irvine32 equivalent)
+            guestOut << '\n';                                   // No endl: flushed at the next input/HALT
+            return true;
+        }
+
+        bool ExecuteAdd(const Instruction& ins) {                       // Add two registers or a variable into register
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  ADD " << OperandText(ops[0]) << ", " << OperandText(ops[1]) << endl;
+            int& dest = Reg(ops[0].value);                  // Destination register
+            int oldValue = dest;                            // Store original value for the flags
+            int operand2 = ReadOperand(ops[1]);             // Second operand (register, variable, or immediate)
+
+            dest = (int)((uint32_t)dest + (uint32_t)operand2); // Add source to destination register (wraps; signed overflow is UB)
+            VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << dest << endl;
+
+            SetArithmeticFlags(FLAGS_ADD, oldValue, operand2, dest);        // Flags are derived from these when read
+
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteSub(const Instruction& ins) {                       // Subtract two registers or a var into register
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  SUB " << OperandText(ops[0]) << ", " << OperandText(ops[1]) << endl;
+            int& dest = Reg(ops[0].value);                  // Destination register
+            int oldValue = dest;                            // Store original value for the flags
+            int operand2 = ReadOperand(ops[1]);             // Second operand (register, variable, or immediate)
+
+            dest = (int)((uint32_t)dest - (uint32_t)operand2); // Subtract source from destination (wraps; signed overflow is UB)
+            VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << dest << endl;
+
+            SetArithmeticFlags(FLAGS_SUB, oldValue, operand2, dest); // Flags are derived from these when read (CF = borrow)
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteIdiv(const Instruction& ins) {                      // Division
+            const Operand* ops = ins.ops;                               // Decoded operands
+            // Signed division: EDX:EAX / divisor
+            VM_TRACE(TRACE_FULL) << "  IDIV " << OperandText(ops[0]) << endl;
+            int divisor = ReadOperand(ops[0]);                  // Divisor (register, variable, or immediate)
+
+            if (divisor == 0) {
+                 VM_TRACE(TRACE_ERRORS) << "  -> ERROR: Division by zero!" << endl;
+
+                SetFlags(false, false, true, true);
+            } else {
+                // Dividend is in R0:R1 (64-bit), result in R0, remainder in R1. Built in uint64_t (no shift of
+                // a negative value); R0 is sign-extended as before, so after CDQ this is EDX:EAX
+                int64_t dividend = (int64_t)((uint64_t)(int64_t)Reg(0) | ((uint64_t)(uint32_t)Reg(1) << 32));
+                if (divisor == -1 && dividend == INT64_MIN) return Fault("IDIV overflow"); // Would trap on the host
+                Reg(0) = (int)(dividend / divisor);      // Quotient, truncated to 32 bits as before
+                Reg(1) = (int)(dividend % divisor);      // Remainder (|remainder| < |divisor|, fits)
+
+                VM_TRACE(TRACE_FULL) << "  -> R0 (quotient) = " << Reg(0) << endl;
+                VM_TRACE(TRACE_FULL) << "  -> R1 (remainder) = " << Reg(1) << endl;
+
+                // Set flags for IDIV (OF and CF cleared)
+                SetFlags(Reg(0) == 0, Reg(0) < 0, false, false);
+
+                VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << endl;
             }
-            else if (opcode == "MOV") {                             // Check if instruction is MOV
-                if (tokens.size() > 2) {                                                       // Verify that at least 3 tokens exist (MOV, dest, src)
-                    cout << "  MOV " << tokens[1] << ", " << tokens[2] << endl;                // Print the MOV instruction being executed
-                    
-                    // Handle MOV to register
-                    if (IsRegister(tokens[1])) {                                               // Check if destination is a register
-                        
-                        // Handle "OFFSET bufferName" syntax
-                        if (tokens[2] == "OFFSET" && tokens.size() > 3) {                      // Check if source uses OFFSET keyword
-                            string bufferName = tokens[3];                                     // Extract the buffer name
-                            int address = GetStringBufferAddress(bufferName);                  // Get the address of the buffer
-                            registers[tokens[1]] = address;                                    // Store address in destination register
-                            cout << "  -> " << tokens[1] << " = 0x" << hex << address  << dec << " (address of " << bufferName << ")" << endl;  // Print the address stored in hex format
-                        }
+            return true;
+        }
 
-                        // Regular MOV operations
-                        else if (IsRegister(tokens[2])) {                                      // Check if source is also a register
-                            registers[tokens[1]] = registers[tokens[2]];                       // Copy source register value to destination
-                        }
-                        else if (IsVariable(tokens[2])) {                                      // Check if source is a variable
-                            registers[tokens[1]] = GetVariableValue(tokens[2]);                // Get variable value and store in destination register
-                        }
-                        else {                                                                 // Source must be an immediate value
-                            registers[tokens[1]] = stoi(tokens[2]);                            // Convert string to integer and store in destination
-                        }
-                        
-                        if (tokens[2] != "OFFSET") {                                           // Only print if not an OFFSET operation (already printed above)
-                            cout << "  -> " << tokens[1] << " = " << registers[tokens[1]]  << endl; // Print the final value in the destination register
-                        }
-                        
-                        // MOV to register affects flags
-                        int result = registers[tokens[1]];                                     // Get the result value from the destination register
-                        ZF = (result == 0);                                                    // Set Zero Flag if result is zero
-                        SF = (result < 0);                                                     // Set Sign Flag if result is negative
-                        cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << endl;               // Print the updated flag values
-                    }
-                    
-                    // Handle MOV from calculator variables to registers (source is calculator variable)
-                    else if (IsVariable(tokens[1])) {                                          // Check if destination is a variable
-                        int value;                                                             // Declare variable to hold the value
+        bool ExecuteImul(const Instruction& ins) {                      // Multiplication
+            const Operand* ops = ins.ops;                               // Decoded operands
+            // Signed multiplication
+            VM_TRACE(TRACE_FULL) << "  IMUL " << OperandText(ops[0]) << ", " << OperandText(ops[1]) << endl;
+            int& dest = Reg(ops[0].value);                      // Destination register
+            int operand2 = ReadOperand(ops[1]);                 // Second operand (register, variable, or immediate)
 
-                        if (IsRegister(tokens[2])) {                                           // Check if source is a register
-                            value = registers[tokens[2]];                                      // Get value from source register
-                        }
-                        else if (IsVariable(tokens[2])) {                                      // Check if source is a variable
-                            value = GetVariableValue(tokens[2]);                               // Get value from source variable
-                        }
-                        else {                                                                 // Source must be an immediate value
-                            value = stoi(tokens[2]);                                           // Convert string to integer
-                        }
+            long long result = (long long)dest * (long long)operand2;
+            dest = (int)result;                                 // Store lower 32 bits
+            VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << dest << endl;
 
-                        SetVariableValue(tokens[1], value);                                    // Store the value in the destination variable
-                        cout << "  -> " << tokens[1] << " = " << GetVariableValue(tokens[1]) << endl;   // Print the final value stored in the variable
-                    }
-                    
-                    // Handle "MOV BYTE PTR [reg + offset], value"
-                    else if (tokens[1] == "BYTE" && tokens.size() > 4 && tokens[2] == "PTR") { // Check for BYTE PTR memory operation syntax
-                        // Parse memory address: [R5 + R1] or [R5 + 0]
-                        string addrExpr = tokens[3];                                           // Extract address expression (should be like "[R5")
-                        string offsetExpr = tokens[4];                                         // Extract offset expression (should be "+")
-                        if (addrExpr[0] == '[') {                                              // Check if opening bracket is present
-                            addrExpr = addrExpr.substr(1);                                     // Remove the opening bracket
-                        }
-                        
-                        int baseAddr = 0;                                                      // Initialize base address to zero
-                        int offset = 0;                                                        // Initialize offset to zero
-                        
-                        if (IsRegister(addrExpr)) {                                            // Check if address expression is a register
-                            baseAddr = registers[addrExpr];                                    // Get the base address from the register
-                        }
-                        
-                        // Handle offset (could be "+", "R1]", or "0]")
-                        if (tokens.size() > 5) {                                               // Check if offset tokens exist
-                            string offsetToken = tokens[5];                                    // Extract the offset token
-                            if (offsetToken.back() == ']') {                                   // Check if closing bracket is present
-                                offsetToken = offsetToken.substr(0, offsetToken.length() - 1); // Remove the closing bracket
-                            }
-                            
-                            if (IsRegister(offsetToken)) {                                     // Check if offset is a register
-                                offset = registers[offsetToken];                               // Get offset value from register
-                            }
-                            else {                                                             // Offset must be an immediate value
-                                offset = stoi(offsetToken);                                    // Convert string to integer
-                            }
-                        }
-                        
-                        int finalAddress = baseAddr + offset;                                  // Calculate final memory address
-                        
-                        // Get value to store
-                        int value = 0;                                                         // Initialize value variable
-                        string valueToken = tokens[tokens.size() - 1];                         // Get the last token (the value to store)
-                        if (valueToken.back() == ',') {                                        // Check if comma is present at the end
-                            valueToken = valueToken.substr(0, valueToken.length() - 1);       // Remove the trailing comma
-                        }
-                        
-                        if (IsRegister(valueToken)) {                                          // Check if value token is a register
-                            value = registers[valueToken];                                     // Get value from the register
-                        }
-                        else {                                                                 // Value must be an immediate value
-                            value = stoi(valueToken);                                          // Convert string to integer
-                        }
-                        
-                        WriteVirtualMemory(finalAddress, value);                               // Write the value to virtual memory at final address
-                        cout << "  -> MOV BYTE PTR: stored value " << value << " at address 0x" // Print operation confirmation
-                             << hex << finalAddress << dec << endl;
+            // Set flags for IMUL: OF and CF are set if the result exceeds 32-bit signed range
+            bool overflow = (result > INT_MAX || result < INT_MIN);
+            SetFlags(dest == 0, dest < 0, overflow, overflow);
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteMov(const Instruction& ins) {                       // Move into register, variable or BYTE/WORD/DWORD PTR memory
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  MOV " << OperandText(ops[0]) << ", " << (ops[1].kind == OPND_SYMBOL ? "OFFSET " : "") << OperandText(ops[1]) << endl; // Print the MOV instruction being executed
+
+            // Handle MOV to register
+            if (ops[0].kind == OPND_REG) {                                             // Check if destination is a register
+                int& dest = Reg(ops[0].value);                                         // Destination register
+
+                // Handle "OFFSET bufferName" syntax
+                if (ops[1].kind == OPND_SYMBOL) {                                      // Check if source uses OFFSET keyword
+                    const ResolvedSymbol& symbol = symbols[ops[1].value];              // Buffer bound at load time
+                    int address = 0;
+                    if (symbol.isBuffer) {
+                        address = symbol.bufferAddress;                                // Get the address of the buffer
+                    } else {
+                        VM_TRACE(TRACE_ERRORS) << "  -> ERROR: String buffer '" << OperandText(ops[1]) << "' not found!" << endl;
                     }
+                    dest = address;                                                    // Store address in destination register
+                    VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = 0x" << hex << address  << dec << " (address of " << OperandText(ops[1]) << ")" << endl;  // Print the address stored in hex format
                 }
-            }
-            else if (opcode == "MOVZX") {                           // Check if instruction is MOVZX (move with zero-extend)
-                if (tokens.size() > 3) {                                                       // Verify that at least 4 tokens exist
-                    string destReg = tokens[1];                                                // Extract destination register
-                    if (destReg.back() == ',') {                                               // Check if comma is present at the end
-                        destReg = destReg.substr(0, destReg.length() - 1);                     // Remove the trailing comma
-                    }
-                    
-                    if (IsRegister(destReg) && tokens[2] == "BYTE" && tokens[3] == "PTR") {   // Verify MOVZX BYTE PTR syntax
-                        // tokens[4] should be something like "[R4" and remaining should be "+", "R1]"
-                        int baseAddr = 0;                                                      // Initialize base address to zero
-                        int offset = 0;                                                        // Initialize offset to zero
-                        
-                        // Parse [R4 + R1] format more carefully
-                        if (tokens.size() >= 5) {                                              // Check if address tokens exist
-                            string addrExpr = tokens[4];                                       // Extract address expression (e.g., "[R4")
-                            if (addrExpr[0] == '[') {                                          // Check if opening bracket is present
-                                addrExpr = addrExpr.substr(1);                                 // Remove the opening bracket
-                            }
-                            if (IsRegister(addrExpr)) {                                        // Check if address expression is a register
-                                baseAddr = registers[addrExpr];                                // Get the base address from the register
-                            }
-                            
-                            // Now parse the offset if it exists
-                            if (tokens.size() >= 7 && tokens[5] == "+") {                      // Check if offset operator and tokens exist
-                                string offsetToken = tokens[6];                                // Extract the offset token
-                                // Remove closing bracket if present
-                                if (offsetToken.back() == ']') {                               // Check if closing bracket is present
-                                    offsetToken = offsetToken.substr(0, offsetToken.length() - 1); // Remove the closing bracket
-                                }
-                                
-                                if (IsRegister(offsetToken)) {                                 // Check if offset is a register
-                                    offset = registers[offsetToken];                           // Get offset value from register
-                                }
-                                else {                                                         // Offset must be an immediate value
-                                    offset = stoi(offsetToken);                                // Convert string to integer
-                                }
-                            }
-                        }
-                        
-                        int finalAddress = baseAddr + offset;                                  // Calculate final memory address
-                        int byteValue = ReadVirtualMemory(finalAddress) & 0xFF;               // Read byte from virtual memory and mask to 8 bits (zero-extend)
-                        registers[destReg] = byteValue;                                        // Store the zero-extended byte value in destination register
-                        // Print operation confirmation
-                        cout << "  -> MOVZX: loaded byte " << byteValue << " from address 0x" << hex << finalAddress << dec << " into " << destReg << endl;
-                    }
+
+                // Typed memory load "MOV reg, <size> PTR [mem]" (narrow sizes are zero-extended)
+                else if (ops[1].kind == OPND_MEM) {
+                    int address = EffectiveAddress(ops[1]);                            // Calculate source memory address
+                    dest = ReadVirtualMemory(address, ops[1].width);                   // Load 1, 2 or 4 bytes
+                    VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << dest << " (from address 0x" << hex << address << dec << ")" << endl;
                 }
-            }
-            
-            // ========== COMPARISON AND BRANCHING ==========
-            else if (opcode == "CMP") {                             // Compare two values
-                if (tokens.size() > 2) {                     // Check 1: Verify instruction has at least 3 tokens (opcode + 2 operands)
-                    // Remove colons from operands
-                    string op1 = tokens[1];
-                    string op2 = tokens[2];
-                    if (op1.back() == ':') op1 = op1.substr(0, op1.length() - 1);
-                    if (op2.back() == ':') op2 = op2.substr(0, op2.length() - 1);
-                    
-                    cout << "  CMP " << op1 << ", " << op2 << endl;
-                    int val1, val2;                          // Values to compare
-                    
-                    // Parse first operand (can be register, immediate, special variable, or calculator variable)
-                    if (op1 == "matrixAllocated") { 
-                        val1 = matrixAllocated ? 1 : 0; 
-                    } else if (IsRegister(op1)) { 
-                        val1 = registers[op1]; 
-                    } else if (IsVariable(op1)) {
-                        val1 = GetVariableValue(op1);
-                    } else { 
-                        val1 = stoi(op1); 
-                    }
-                    
-                    // Parse second operand (can be register, immediate, special variable, or calculator variable)
-                    if (op2 == "matrixAllocated") { 
-                        val2 = matrixAllocated ? 1 : 0; 
-                    } else if (IsRegister(op2)) { 
-                        val2 = registers[op2]; 
-                    } else if (IsVariable(op2)) {
-                        val2 = GetVariableValue(op2);
-                    } else { 
-                        val2 = stoi(op2); 
-                    }
-                    
-                    int result = val1 - val2;                                               // Compute comparison result
-                    // Set status flags based on comparison
-                    ZF = (result == 0);                          // Zero Flag: values are equal
-                    SF = (result < 0);                           // Sign Flag: first value is less
-                    OF = (val1 > 0 && val2 < 0 && result < 0) || // Overflow detection
-                        (val1 < 0 && val2 > 0 && result > 0);
-                    CF = false;                                 // No carry flag
-                    cout << "  -> Comparison result: " << result << endl;
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << " CF=" << CF << endl;
+
+                // Regular MOV operations (register, variable or immediate source)
+                else {
+                    dest = ReadOperand(ops[1]);                                        // Copy source value to destination
+                    VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << dest  << endl;  // Print the final value in the destination register
                 }
+
+                // MOV to register affects flags
+                SetResultFlags(dest);                                                  // ZF/SF from the value; OF and CF unchanged
+                VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << endl;               // Print the updated flag values
             }
-            else if (opcode == "JE") {                              // Jump if equal (ZF == 1)
-                if (tokens.size() > 1) {
-                    if (ZF) {                                // Check Zero Flag
-                        string label = tokens[1];            // Target label
-                        if (labels.find(label) != labels.end()) {
-                            programCounter = labels[label];  // Jump to label address
-                            cout << "  -> Jump equal to " << label << " at line " << programCounter << endl;
-                            incrementPC = false;             // Don't increment PC after jump
-                        }
-                    } else {
-                        cout << "  -> JE condition false (ZF=" << ZF << "), not jumping" << endl;
-                    }
-                }
+
+            // Handle MOV from calculator variables to registers (source is calculator variable)
+            else if (ops[0].kind == OPND_VAR) {                                        // Check if destination is a variable
+                int value = ReadOperand(ops[1]);                                       // Register, variable or immediate source
+                SetVariableValue(ops[0].value, value);                                 // Store the value in the destination variable
+                VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << GetVariableValue(ops[0].value) << endl;   // Print the final value stored in the variable
             }
-            else if (opcode == "JNE") {                             // Jump if not equal (ZF == 0)
-                if (tokens.size() > 1) {
-                    if (!ZF) {                               // Check Zero Flag is false
-                        string label = tokens[1];            // Target label
-                        if (labels.find(label) != labels.end()) {
-                            programCounter = labels[label];  // Jump to label address
-                            cout << "  -> Jump not equal to " << label << " at line " << programCounter << endl;
-                            incrementPC = false;             // Don't increment PC after jump
-                        }
-                    } else {
-                        cout << "  -> JNE condition false (ZF=" << ZF << "), not jumping" << endl;
-                    }
-                }
+
+            // Handle "MOV BYTE/WORD/DWORD PTR [reg + offset], value"
+            else if (ops[0].kind == OPND_MEM) {                                        // Typed memory destination
+                int finalAddress = EffectiveAddress(ops[0]);                           // Calculate final memory address
+                int value = ReadOperand(ops[1]);                                       // Register or immediate value to store
+                WriteVirtualMemory(finalAddress, value, ops[0].width);                 // Write only the low 1, 2 or 4 bytes of the value
+                VM_TRACE(TRACE_FULL) << "  -> MOV " << (ops[0].width == BYTE_SIZE ? "BYTE" : ops[0].width == WORD_SIZE ? "WORD" : "DWORD") // Print operation confirmation
+                     << " PTR: stored value " << value << " at address 0x" << hex << finalAddress << dec << endl;
             }
-            else if (opcode == "JL") {                              // Jump if less (SF != OF)
-                if (tokens.size() > 1) {
-                    if (SF != OF) {                          // JL condition: Sign Flag != Overflow Flag
-                        string label = tokens[1];            // Target label
-                        if (labels.find(label) != labels.end()) {
-                            programCounter = labels[label];  // Jump to label address
-                            cout << "  -> Jump less to " << label << " at line " << programCounter << endl;
-                            incrementPC = false;             // Don't increment PC after jump
-                        }
-                    } else {
-                        cout << "  -> JL condition false (SF=" << SF << ", OF=" << OF << "), not jumping" << endl;
-                    }
-                }
+            return true;
+        }
+
+        bool ExecuteMovzx(const Instruction& ins) {                     // Move byte/word with zero-extend into register
+            const Operand* ops = ins.ops;                               // Decoded operands
+            int finalAddress = EffectiveAddress(ops[1]);                           // Calculate final memory address [base + offset]
+            int value = ReadVirtualMemory(finalAddress, ops[1].width);             // Read 1 or 2 bytes from virtual memory (zero-extended)
+            Reg(ops[0].value) = value;                                             // Store the zero-extended value in destination register
+            // Print operation confirmation
+            VM_TRACE(TRACE_FULL) << "  -> MOVZX: loaded " << (ops[1].width == BYTE_SIZE ? "byte " : "word ") << value << " from address 0x" << hex << finalAddress << dec << " into " << OperandText(ops[0]) << endl;
+            return true;
+        }
+
+        bool ExecuteCmp(const Instruction& ins) {                       // Compare two values
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  CMP " << OperandText(ops[0]) << ", " << OperandText(ops[1]) << endl;
+            int val1 = ReadOperand(ops[0]);              // First operand (register, immediate, special variable, or calculator variable)
+            int val2 = ReadOperand(ops[1]);              // Second operand (register, immediate, special variable, or calculator variable)
+
+            int result = (int)((uint32_t)val1 - (uint32_t)val2);                    // Compute comparison result (wraps)
+            SetArithmeticFlags(FLAGS_SUB, val1, val2, result);                      // Flags as for SUB, derived when a Jcc reads them
+            VM_TRACE(TRACE_FULL) << "  -> Comparison result: " << result << endl;
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << " CF=" << CarryFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteJe(const Instruction& ins) {                        // Jump if equal (ZF == 1)
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ZeroFlag()) {                            // Check Zero Flag
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> Jump equal to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;                        // Don't increment PC after jump
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> JE condition false (ZF=" << ZeroFlag() << "), not jumping" << endl;
             }
-            else if (opcode == "JLE") {                             // Jump if less or equal (ZF || (SF != OF))
-                if (tokens.size() > 1) {
-                    if (ZF || (SF != OF)) {                  // JLE condition: equal OR less
-                        string label = tokens[1];            // Target label
-                        if (labels.find(label) != labels.end()) {
-                            programCounter = labels[label];  // Jump to label address
-                            cout << "  -> Jump less or equal to " << label << " at line " << programCounter << endl;
-                            incrementPC = false;             // Don't increment PC after jump
-                        }
-                    } else {
-                        cout << "  -> JLE condition false (ZF=" << ZF << ", SF=" << SF << ", OF=" << OF << "), not jumping" << endl;
-                    }
-                }
+            return true;
+        }
+
+        bool ExecuteJne(const Instruction& ins) {                       // Jump if not equal (ZF == 0)
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (!ZeroFlag()) {                           // Check Zero Flag is false
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> Jump not equal to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;                        // Don't increment PC after jump
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> JNE condition false (ZF=" << ZeroFlag() << "), not jumping" << endl;
             }
-            else if (opcode == "JGE") {                             // Jump if greater or equal (SF == OF)
-                if (tokens.size() > 1) {
-                    if (SF == OF) {                          // JGE condition
-                        string label = tokens[1];
-                        if (labels.find(label) != labels.end()) {
-                            programCounter = labels[label];
-                            cout << "  -> Jump greater or equal to " << label << " at line " << programCounter << endl;
-                            incrementPC = false;
-                        }
-                    } else {
-                        cout << "  -> JGE condition false (SF=" << SF << ", OF=" << OF << "), not jumping" << endl;
-                    }
-                }
+            return true;
+        }
+
+        bool ExecuteJl(const Instruction& ins) {                        // Jump if less (SF != OF)
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ConditionHolds(COND_L)) {                // JL condition: Sign Flag != Overflow Flag
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> Jump less to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;                        // Don't increment PC after jump
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> JL condition false (SF=" << SignFlag() << ", OF=" << OverflowFlag() << "), not jumping" << endl;
             }
-            else if (opcode == "JMP") {                             // Unconditional jump
-                if (tokens.size() > 1) {
-                    string label = tokens[1];                // Target label
-                    if (labels.find(label) != labels.end()) {
-                        programCounter = labels[label];      // Jump to label address
-                        cout << "  -> Jumping to " << label << " at line " << programCounter << endl;
-                        incrementPC = false;                 // Don't increment PC after jump
-                    }
-                }
+            return true;
+        }
+
+        bool ExecuteJle(const Instruction& ins) {                       // Jump if less or equal (ZF || (SF != OF))
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ConditionHolds(COND_LE)) {               // JLE condition: equal OR less
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> Jump less or equal to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;                        // Don't increment PC after jump
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> JLE condition false (ZF=" << ZeroFlag() << ", SF=" << SignFlag() << ", OF=" << OverflowFlag() << "), not jumping" << endl;
             }
+            return true;
+        }
 
-            // ========== SYSTEM INSTRUCTIONS ==========
-            else if (opcode == "INC") {                             // Increment register by 1
-                // Remove colon if present
-                string operand = tokens[1];
-                if (operand.back() == ':') {
-                    operand = operand.substr(0, operand.length() - 1);
-                }
-                
-                if (tokens.size() > 1 && IsRegister(operand)) {
-                    cout << "  INC " << operand << endl;
-                    registers[operand]++;
-                    cout << "  -> " << operand << " = " << registers[operand] << endl;
-                    
-                    // Set flags
-                    int result = registers[operand];
-                    ZF = (result == 0);
-                    SF = (result < 0);
-                    OF = (result == INT_MIN);  // Overflow if wrapped around
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << endl;
-                }
+        bool ExecuteJge(const Instruction& ins) {                       // Jump if greater or equal (SF == OF)
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ConditionHolds(COND_GE)) {               // JGE condition (SF == OF)
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> Jump greater or equal to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> JGE condition false (SF=" << SignFlag() << ", OF=" << OverflowFlag() << "), not jumping" << endl;
             }
-            else if (opcode == "DEC") {                             // Decrement register by 1
-                if (tokens.size() > 1 && IsRegister(tokens[1])) {
-                    cout << "  DEC " << tokens[1] << endl;
-                    registers[tokens[1]]--;
-                    cout << "  -> " << tokens[1] << " = " << registers[tokens[1]] << endl;
-                    
-                    // Set flags
-                    int result = registers[tokens[1]];
-                    ZF = (result == 0);
-                    SF = (result < 0);
-                    OF = (result == INT_MAX);  // Overflow if wrapped around
-                    cout << "  -> Flags: ZF=" << ZF << " SF=" << SF << " OF=" << OF << endl;
-                }
+            return true;
+        }
+
+        bool ExecuteJcc(const Instruction& ins) {                       // JG, JA, JAE, JB, JBE, JZ, JNZ, JS, JNS, JO, JNO
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ConditionHolds(ConditionOf(ins.opcode))) {
+                programCounter = ops[0].value;           // Jump to label address (resolved at load time)
+                VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << ": jump to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+                return false;                        // Don't increment PC after jump
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << " condition false (ZF=" << ZeroFlag() << ", SF=" << SignFlag()
+                     << ", OF=" << OverflowFlag() << ", CF=" << CarryFlag() << "), not jumping" << endl;
             }
-            else if (opcode == "CDQ") {
-                // Convert Doubleword to Quadword (sign extend EAX into EDX:EAX)
-                // In our simple VM, we'll simulate this for division
-                if (registers["R0"] < 0) {
-                    registers["R1"] = -1; // R1 is EDX equivalent (all bits 1 for negative)
-                } else {
-                    registers["R1"] = 0;  // R1 is EDX equivalent (all bits 0 for positive)
-                }
-                cout << "  -> CDQ: (R0:R1) EDX:EAX prepared for division" << endl;
+            return true;
+        }
+
+        bool ExecuteSetCC(const Instruction& ins) {                     // SETcc reg: reg = 1 if the condition holds, else 0
+            const Operand* ops = ins.ops;                               // Decoded operands
+            Reg(ops[0].value) = ConditionHolds(ConditionOf(ins.opcode)) ? 1 : 0;   // Whole register (no byte registers); flags unchanged
+            VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << ": " << OperandText(ops[0]) << " = " << Reg(ops[0].value) << endl;
+            return true;
+        }
+
+        bool ExecuteCMovCC(const Instruction& ins) {                    // CMOVcc reg, value: reg = value if the condition holds
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (ConditionHolds(ConditionOf(ins.opcode))) {
+                Reg(ops[0].value) = ReadOperand(ops[1]);                // Register, variable or immediate; flags unchanged
+                VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << ": " << OperandText(ops[0]) << " = " << Reg(ops[0].value) << endl;
+            } else {
+                VM_TRACE(TRACE_FULL) << "  -> " << OpcodeNames[ins.opcode] << " condition false, " << OperandText(ops[0]) << " unchanged" << endl;
             }
-            else if (opcode == "CLRSC") {                           // Clear screen instruction
-                cout << "  CLRSC instruction executed" << endl;
-                _getch();;                                  // Waits for user to press any key
-                system("cls");                              // Clear console screen
-                cout << "  -> Screen cleared" << endl;
+            return true;
+        }
+
+        bool ExecuteJmp(const Instruction& ins) {                       // Unconditional jump
+            const Operand* ops = ins.ops;                               // Decoded operands
+            programCounter = ops[0].value;               // Jump to label address (resolved at load time)
+            VM_TRACE(TRACE_FULL) << "  -> Jumping to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+            return false;                                // Don't increment PC after jump
+        }
+
+        bool ExecuteCall(const Instruction& ins) {                      // Handle function CALL instruction
+            const Operand* ops = ins.ops;                               // Decoded operands
+            if (!callStack.Push(programCounter + 1)) return Fault("call stack overflow"); // Return address (next instruction)
+            programCounter = ops[0].value;                      // Jump PC to label address (resolved at load time)
+            VM_TRACE(TRACE_CALLS) << "  -> CALL: jumping to " << OperandText(ops[0]) << " at line " << LineOf(programCounter) << endl;
+            return false;                                       // Skip PC increment for direct jump
+        }
+
+        bool ExecuteRet(const Instruction& ins) {                       // Handle return from function call
+            int32_t returnAddress;
+            if (!callStack.Pop(returnAddress)) return Fault("RET with empty call stack");
+            programCounter = returnAddress;                     // Jump PC back to return address
+            VM_TRACE(TRACE_CALLS) << "  -> RET: returning to line " << LineOf(programCounter) << endl;
+            return false;                                       // Skip PC increment for direct jump
+        }
+
+        bool ExecuteInc(const Instruction& ins) {                       // Increment register by 1
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  INC " << OperandText(ops[0]) << endl;
+            int& reg = Reg(ops[0].value);
+            reg = (int)((uint32_t)reg + 1);                 // Wraps INT_MAX to INT_MIN (signed overflow is UB)
+            VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << reg << endl;
+
+            SetIncDecFlags(FLAGS_INC, reg);                 // OF if wrapped around; CF unchanged
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteDec(const Instruction& ins) {                       // Decrement register by 1
+            const Operand* ops = ins.ops;                               // Decoded operands
+            VM_TRACE(TRACE_FULL) << "  DEC " << OperandText(ops[0]) << endl;
+            int& reg = Reg(ops[0].value);
+            reg = (int)((uint32_t)reg - 1);                 // Wraps INT_MIN to INT_MAX
+            VM_TRACE(TRACE_FULL) << "  -> " << OperandText(ops[0]) << " = " << reg << endl;
+
+            SetIncDecFlags(FLAGS_DEC, reg);                 // OF if wrapped around; CF unchanged
+            VM_TRACE(TRACE_FULL) << "  -> Flags: ZF=" << ZeroFlag() << " SF=" << SignFlag() << " OF=" << OverflowFlag() << endl;
+            return true;
+        }
+
+        bool ExecuteCdq(const Instruction& ins) {                       // Sign extend R0 into R1
+            // Convert Doubleword to Quadword (sign extend EAX into EDX:EAX)
+            // In our simple VM, we'll simulate this for division
+            if (Reg(0) < 0) {
+                Reg(1) = -1; // R1 is EDX equivalent (all bits 1 for negative)
+            } else {
+                Reg(1) = 0;  // R1 is EDX equivalent (all bits 0 for positive)
             }
-            else if (opcode == "HALT") {                            // Stop program execution
-                running = false;                             // Set VM running flag to false
-                cout << "  -> Program halted." << endl;      // Display halt message
+            VM_TRACE(TRACE_FULL) << "  -> CDQ: (R0:R1) EDX:EAX prepared for division" << endl;
+            return true;
+        }
+
+        bool ExecuteClrsc(const Instruction& ins) {                     // Clear screen instruction
+            VM_TRACE(TRACE_FULL) << "  CLRSC instruction executed" << endl;
+            if (!batchMode) {                           // Batch runs neither wait nor clear
+                guestOut.Flush();                       // "Press any key" prompt must be visible
+                _getch();                               // Waits for user to press any key
+                guestOut << "\033[2J\033[H";             // ANSI clear screen + cursor home (no shell process)
+                guestOut.Flush();
             }
-            
-            return incrementPC;                                     // Return whether to increment program counter
+            VM_TRACE(TRACE_FULL) << "  -> Screen cleared" << endl;
+            return true;
         }
-        
+
+        bool ExecuteHalt(const Instruction& ins) {                      // Stop program execution
+            running = false;                             // Set VM running flag to false
+            guestOut.Flush();                            // Program output is complete
+            VM_TRACE(TRACE_CALLS) << "  -> Program halted." << endl;      // Display halt message
+            return true;
+        }
+
         void InputMatrixValues(int baseAddress) {                       // Read matrix values from user input
             for (int i = 0; i < matrixSize; i++) {                      // Iterate through each row of matrix
                 for (int j = 0; j < matrixSize; j++) {                  // Iterate through each column of matrix
-                    cout << stringMemory["matrixElemPrompt"] << i << "," << j << stringMemory["matrixElemPrompt2"]; // Display prompt for element [i][j]
+                    guestOut << stringMemory["matrixElemPrompt"] << i << "," << j << stringMemory["matrixElemPrompt2"]; // Display prompt for element [i][j]
                     int value;
-                    cin >> value;                             // Read integer value from user
+                    guestOut.Flush();                         // Prompt must be visible before blocking on input
+                    *guestIn >> value;                        // Read integer value from user
+                    if (InputExhausted()) return;
                     int elementAddress = GetMatrixElementAddress(baseAddress, i, j, matrixSize); // Calculate memory address
                     WriteVirtualMemory(elementAddress, value);// Store value in virtual memory
                 }
@@ -1029,28 +3794,28 @@ private:
         // Helper function to display all matrix
         void DisplayMatrix(int baseAddress) {                           // Print matrix contents to console
             for (int i = 0; i < matrixSize; i++) {                      // Iterate through each row
-                cout << "\033[38;5;118m" << stringMemory["matrixDisplayRow"] << "\033[38;5;118m" << i << stringMemory["matrixDisplayCol"] << "\033[0m"; // Display row header
+                guestOut << "\033[38;5;118m" << stringMemory["matrixDisplayRow"] << "\033[38;5;118m" << i << stringMemory["matrixDisplayCol"] << "\033[0m"; // Display row header
                 for (int j = 0; j < matrixSize; j++) {                  // Iterate through each column
                     int elementAddress = GetMatrixElementAddress(baseAddress, i, j, matrixSize); // Get element memory address
                     int value = ReadVirtualMemory(elementAddress);      // Read value from virtual memory
-                    cout << value << stringMemory["spaceChar"];         // Print value followed by space
+                    guestOut << value << stringMemory["spaceChar"];     // Print value followed by space
                 }
-                cout << endl;                                           // New line after each row
+                guestOut << '\n';                                       // New line after each row
             }
         }
 
         // Helper function to free all matrix
         void FreeAllMatrices() {                                        // Deallocate memory for all matrices
             if (matrixPointers["matrixA"] != 0) {                       // Check if matrix A is allocated
-                FreeVirtualMemory(matrixPointers["matrixA"], matrixSize * matrixSize * 4); // Free matrix A memory
+                FreeVirtualMemory(matrixPointers["matrixA"]); // Free matrix A memory
                 matrixPointers["matrixA"] = 0;                          // Reset matrix A pointer to unallocated
             }
             if (matrixPointers["matrixB"] != 0) {                       // Check if matrix B is allocated
-                FreeVirtualMemory(matrixPointers["matrixB"], matrixSize * matrixSize * 4); // Free matrix B memory
+                FreeVirtualMemory(matrixPointers["matrixB"]); // Free matrix B memory
                 matrixPointers["matrixB"] = 0;                          // Reset matrix B pointer to unallocated
             }
             if (matrixPointers["matrixC"] != 0) {                       // Check if matrix C is allocated
-                FreeVirtualMemory(matrixPointers["matrixC"], matrixSize * matrixSize * 4); // Free matrix C memory
+                FreeVirtualMemory(matrixPointers["matrixC"]); // Free matrix C memory
                 matrixPointers["matrixC"] = 0;                          // Reset matrix C pointer to unallocated
             }
             matrixSize = 0;                                             // Reset matrix size to zero
@@ -1058,32 +3823,42 @@ private:
         }
 
         // Helper function to get variable value
-        int GetVariableValue(const string& varName) {
-            if (varName =="prevResult") return prevResult;
-            if (varName == "firstNum") return firstNum;
-            if (varName == "secondNum") return secondNum;
-            if (varName == "remainder") return remainder;
-            if (varName == "usePrev") return usePrev ? 1 : 0;
-            
-            // Check string variables (addresses and lengths)
-            if (stringVariables.find(varName) != stringVariables.end()) {
-                return stringVariables[varName];
+        int GetVariableValue(int varId) {
+            switch (varId) {
+                case VAR_PREV_RESULT:      return prevResult;
+                case VAR_FIRST_NUM:        return firstNum;
+                case VAR_SECOND_NUM:       return secondNum;
+                case VAR_REMAINDER:        return remainder;
+                case VAR_USE_PREV:         return usePrev ? 1 : 0;
+                case VAR_MATRIX_ALLOCATED: return matrixAllocated ? 1 : 0;
+                case VAR_STRING1_ADDR: case VAR_STRING2_ADDR:                 // String variables (addresses and lengths)
+                case VAR_STRING1_LENGTH: case VAR_STRING2_LENGTH:
+                    return stringVariables[varId - VAR_STRING1_ADDR];
             }
             return 0; // default
         }
         
         // Helper function to set variable value
-        void SetVariableValue(const string& varName, int value) {
-            if (varName == "prevResult") prevResult = value;
-            else if (varName == "firstNum") firstNum = value;
-            else if (varName == "secondNum") secondNum = value;
-            else if (varName == "remainder") remainder = value;
-            else if (varName == "usePrev") usePrev = (value != 0);
-            
-            // Set string variables
-            else if (stringVariables.find(varName) != stringVariables.end()) {
-                stringVariables[varName] = value;
+        void SetVariableValue(int varId, int value) {
+            switch (varId) {
+                case VAR_PREV_RESULT: prevResult = value; break;
+                case VAR_FIRST_NUM:   firstNum = value; break;
+                case VAR_SECOND_NUM:  secondNum = value; break;
+                case VAR_REMAINDER:   remainder = value; break;
+                case VAR_USE_PREV:    usePrev = (value != 0); break;
+                case VAR_STRING1_ADDR: case VAR_STRING2_ADDR:                 // Set string variables
+                case VAR_STRING1_LENGTH: case VAR_STRING2_LENGTH:
+                    stringVariables[varId - VAR_STRING1_ADDR] = value;
+                    break;
+            }
+        }
+
+        // Helper function to map a variable name to its VariableId
+        static int LookupVariable(const string& varName) {
+            for (int i = 0; i < VAR_COUNT; i++) {
+                if (varName == VariableNames[i]) return i;
             }
+            return -1;
         }
         
         vector<string> Tokenize(const string& line) {                   // Split instruction line into individual tokens
@@ -1098,8 +3873,20 @@ private:
         }
         
         // Helper function to check if a token is a regitser name
-        bool IsRegister(const string& token) {                          // Check if token represents a valid register name
-            return token[0] == 'R' && token.size() == 2 && isdigit(token[1]);   // First character must be 'R'     Token must be exactly 2 characters long      Second character must be a digit (0-5)
+        static bool IsRegister(const string& token) {                   // Check if token represents a valid register name
+            return RegisterNumber(token) >= 0;                          // 'R' followed by a register number below VM_REGISTER_COUNT
+        }
+
+        // Helper function to decode a register name into its number (-1 if not a register)
+        static int RegisterNumber(const string& token) {
+            if (token.size() < 2 || token.size() > 4 || token[0] != 'R') return -1;
+            int number = 0;
+            for (size_t i = 1; i < token.size(); i++) {
+                if (!isdigit((unsigned char)token[i])) return -1;
+                number = number * 10 + (token[i] - '0');
+            }
+            if (token.size() > 2 && token[1] == '0') return -1;         // Reject "R01"
+            return (number < VM_REGISTER_COUNT) ? number : -1;
         }
         
         // Helper function to check if a token is a variable name
@@ -1108,639 +3895,867 @@ private:
         }
 };
 
-int main() {
-    VirtualMachine vm;
-    ofstream testFile("memory_program.asm");
-        // Main program structure
-        testFile << "START:\n";
-        testFile << "    CALL DisplayWelcome\n";
-        testFile << "    JMP MenuLoop\n";
-        testFile << "    HALT\n";
-        testFile << "\n";
-        testFile << "MenuLoop:\n";
-        testFile << "    CALL DisplayMenu\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    CALL ExecuteChoice\n";
-        testFile << "    CALL ScreenClear\n";
-        testFile << "    JMP MenuLoop\n";
-        testFile << "\n";
-
-       // Core UI procedures
-        testFile << "DisplayWelcome:\n";
-        testFile << "    PRINT_STR welcomeMsg\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "DisplayMenu:\n";
-        testFile << "    PRINT_STR menuPrompt\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "ReadUserChoice:\n";
-        testFile << "    READ_INT R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "ReadUserString:\n";
-        testFile << "    READ_STRING R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "ContinueMessage:\n";
-        testFile << "    PRINT_STR continueMsg\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "ScreenClear:\n";
-        testFile << "    PRINT_STR continueMsg\n";
-        testFile << "    CLRSC\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // Choice execution
-        testFile << "ExecuteChoice:\n";
-        testFile << "    CMP R0, 1\n";
-        testFile << "    JE CalculatorSection\n";
-        testFile << "    CMP R0, 2\n";
-        testFile << "    JE StringSection\n";
-        testFile << "    CMP R0, 3\n";
-        testFile << "    JE MemorySection\n";
-        testFile << "    CMP R0, 4\n";
-        testFile << "    JE ExitProgram\n";
-        testFile << "    CALL InvalidChoiceMessage\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "InvalidChoiceMessage:\n";
-        testFile << "    PRINT_STR invalidChoiceMsg\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "CalculatorSection:\n";
-        testFile << "    CALL CalculatorModule\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        testFile << "StringSection:\n";
-        testFile << "    CALL StringModule\n";
-        testFile << "    RET\n";
-        testFile << "MemorySection:\n";
-        testFile << "    CALL MemoryModule\n";
-        testFile << "    RET\n";
-
-        // EXIT PROGRAM
-        testFile << "ExitProgram:\n";
-        testFile << "    HALT\n";
-        testFile << "\n";
-
-        // Calculator module
-        testFile << "; ========== CALCULATOR MODULE ==========\n";
-        testFile << "CalculatorModule:\n";
-        testFile << "CalcMenuLoop:\n";
-        testFile << "    CALL DisplayCalcMenu\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    CMP R0, 1\n";
-        testFile << "    JE Addition\n";
-        testFile << "    CMP R0, 2\n";
-        testFile << "    JE Subtraction\n";
-        testFile << "    CMP R0, 3\n";
-        testFile << "    JE Multiplication\n";
-        testFile << "    CMP R0, 4\n";
-        testFile << "    JE Division\n";
-        testFile << "    CMP R0, 5\n";
-        testFile << "    JE CalcEnd\n";
-        testFile << "    CALL InvalidChoiceMessage\n";
-        testFile << "    JMP CalcMenuLoop\n";
-        testFile << "\n";
-        testFile << "Addition:\n";
-        testFile << "    CALL AdditionProcedure\n";
-        testFile << "    JMP AskForNewCalculation\n";
-        testFile << "\n";
-        testFile << "Subtraction:\n";
-        testFile << "    CALL SubtractionProcedure\n";
-        testFile << "    JMP AskForNewCalculation\n";
-        testFile << "\n";
-        testFile << "Multiplication:\n";
-        testFile << "    CALL MultiplicationProcedure\n";
-        testFile << "    JMP AskForNewCalculation\n";
-        testFile << "\n";
-        testFile << "Division:\n";
-        testFile << "    CALL DivisionProcedure\n";
-        testFile << "    JMP AskForNewCalculation\n";
-        testFile << "\n";
-        testFile << "AskForNewCalculation:\n";
-        testFile << "    PRINT_STR newCalcPrompt\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    CMP R0, 1\n";
-        testFile << "    JE CalcMenuLoop\n";
-        testFile << "\n";
-        testFile << "CalcEnd:\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // Calculator sub-procedures
-        testFile << "DisplayCalcMenu:\n";
-        testFile << "    PRINT_STR calcTitle\n";
-        testFile << "    CMP prevResult, 0\n";
-        testFile << "    JE NoPrevResult\n";
-        testFile << "    PRINT_STR calcResult\n";
-        testFile << "    MOV R0, prevResult\n";
-        testFile << "    WRITE_INT R0\n";
-        testFile << "NoPrevResult:\n";
-        testFile << "    PRINT_STR calcMenu\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "GetInputNumbers:\n";
-        testFile << "    CMP prevResult, 0\n";
-        testFile << "    JE getFirstNumber\n";
-        testFile << "    PRINT_STR usePrevResult\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    MOV usePrev, R0\n";
-        testFile << "    CMP usePrev, 1\n";
-        testFile << "    JNE getFirstNumber\n";
-        testFile << "    MOV R0, prevResult\n";
-        testFile << "    MOV firstNum, R0\n";
-        testFile << "    JMP getsecondNumber\n";
-        testFile << "\n";
-        testFile << "getFirstNumber:\n";
-        testFile << "    PRINT_STR enterFirst\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    MOV firstNum, R0\n";
-        testFile << "\n";
-        testFile << "getsecondNumber:\n";
-        testFile << "    PRINT_STR enterSecond\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    MOV secondNum, R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "AdditionProcedure:\n";
-        testFile << "    CALL GetInputNumbers\n";
-        testFile << "    MOV R0, firstNum\n";
-        testFile << "    ADD R0, secondNum\n";
-        testFile << "    MOV prevResult, R0\n";
-        testFile << "    PRINT_STR calcResult\n";
-        testFile << "    WRITE_INT R0\n";   // Display Result
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "SubtractionProcedure:\n";
-        testFile << "    CALL GetInputNumbers\n";
-        testFile << "    MOV R0, firstNum\n";
-        testFile << "    SUB R0, secondNum\n";
-        testFile << "    MOV prevResult, R0\n";
-        testFile << "    PRINT_STR calcResult\n";
-        testFile << "    WRITE_INT R0\n";   // Display Result
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "MultiplicationProcedure:\n";
-        testFile << "    CALL GetInputNumbers\n";
-        testFile << "    MOV R0, firstNum\n";
-        testFile << "    IMUL R0, secondNum\n";
-        testFile << "    MOV prevResult, R0\n";
-        testFile << "    PRINT_STR calcResult\n";
-        testFile << "    WRITE_INT R0\n";   // Display Result
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "DivisionProcedure:\n";
-        testFile << "    CALL GetInputNumbers\n";
-        testFile << "    CMP secondNum, 0\n";
-        testFile << "    JNE PerfromDivision\n";
-        testFile << "    PRINT_STR divByZeroMsg\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        testFile << "PerfromDivision:\n";
-        testFile << "    CMP secondNum, 0\n";
-        testFile << "    MOV R0, firstNum\n";
-        testFile << "    CDQ\n";
-        testFile << "    MOV R1, secondNum\n";
-        testFile << "    IDIV R1\n";
-        testFile << "    MOV prevResult, R0\n";
-        testFile << "    MOV remainder, R1\n";
-        testFile << "    PRINT_STR calcResult\n";
-        testFile << "    WRITE_INT R0\n";   // Display Result
-        testFile << "    MOV R0, remainder\n";
-        testFile << "    CMP R0, 0\n";
-        testFile << "    JE DivisionComplete\n";
-        testFile << "\n";
-        testFile << "DivisionComplete:\n";
-        testFile << "    PRINT_STR remainderMsg\n";
-         testFile << "   WRITE_INT R0\n";   // Display Remainder Result
-        testFile << "    RET\n";
-        testFile << "\n";
-
-
-        // String manipulation module
-        testFile << "; ========== STRING MANIPULATION MODULE ==========\n";
-        testFile << "StringModule:\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    PUSH R1\n";
-        testFile << "    PUSH R2\n";
-        testFile << "StringMenuLoop:\n";
-        testFile << "    CALL DisplayStringMenu\n";
-        testFile << "    CALL ReadUserChoice\n";
-        testFile << "    CMP R0, 1\n";
-        testFile << "    JE StringReverse\n";
-        testFile << "    CMP R0, 2\n";
-        testFile << "    JE StringConcatenation\n";
-        testFile << "    CMP R0, 3\n";
-        testFile << "    JE StringCopy\n";
-        testFile << "    CMP R0, 4\n";
-        testFile << "    JE StringCompare\n";
-        testFile << "    CMP R0, 5\n";
-        testFile << "    JE StringEnd\n";
-        testFile << "    CALL InvalidChoiceMessage\n";
-        testFile << "    JMP StringMenuLoop\n";
-        testFile << "\n";
-        testFile << "StringReverse:\n";
-        testFile << "    CALL StringReverseProcedure\n";
-        testFile << "    JMP StringMenuLoop\n";
-        testFile << "\n";
-        testFile << "StringConcatenation:\n";
-        testFile << "    CALL StringConcatenationProcedure\n";
-        testFile << "    JMP StringMenuLoop\n";
-        testFile << "\n";
-        testFile << "StringCopy:\n";
-        testFile << "    CALL StringCopyProcedure\n";
-        testFile << "    JMP StringMenuLoop\n";
-        testFile << "\n";
-        testFile << "StringCompare:\n";
-        testFile << "    CALL StringCompareProcedure\n";
-        testFile << "    JMP StringMenuLoop\n";
-        testFile << "\n";
-        testFile << "StringEnd:\n";
-        testFile << "    POP R2\n";
-        testFile << "    POP R1\n";
-        testFile << "    POP R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // String menu display
-        testFile << "DisplayStringMenu:\n";
-        testFile << "    PUSH R3\n";
-        testFile << "    PRINT_STR stringTitle\n";
-        testFile << "    PRINT_STR stringMenu\n";
-        testFile << "    POP R3\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // String operation procedures
-        testFile << "StringReverseProcedure:\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    PUSH R1\n";
-        testFile << "    PUSH R2\n";
-        testFile << "    PUSH R3\n";
-        testFile << "    PUSH R4\n";
-        testFile << "    PUSH R5\n";
-        testFile << "    PRINT_STR stringPrompt1\n";
-        testFile << "    MOV R3, OFFSET string1\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "    CMP R0, 0\n";
-        testFile << "    JE ReverseEmpty\n";
-        testFile << "    MOV R4, R3\n";
-        testFile << "    MOV R2, R0\n";
-        testFile << "    MOV R1, 0\n";
-        testFile << "\n";
-
-        // Push all characters onto stack (reverses order)
-        testFile << "ReversePushLoop:\n"; 
-        testFile << "    MOVZX R0, BYTE PTR [R4 + R1]\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    INC R1\n";
-        testFile << "    CMP R1, R2\n";
-        testFile << "    JL ReversePushLoop\n";
-        testFile << "    MOV R1, 0\n";
-        testFile << "    MOV R5, OFFSET reversedString\n";
-        testFile << "\n";
-
-        // Pop characters back in reverse order (LIFO)
-        testFile << "ReversePopLoop:\n";
-        testFile << "    POP R0\n";
-        testFile << "    MOV BYTE PTR [R5 + R1], R0\n";
-        testFile << "    INC R1\n";
-        testFile << "    CMP R1, R2\n";
-        testFile << "    JL ReversePopLoop\n";
-        testFile << "\n";
-
-        // Null terminate the reversed string
-        testFile << "    MOV BYTE PTR [R5 + R1], 0\n";
-        testFile << "\n";
-
-        // Display results
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR originalStr\n";
-        testFile << "    PRINT_STR string1\n";
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR reversedStr\n";
-        testFile << "    PRINT_STR reversedString\n";
-        testFile << "    Crlf\n";
-        testFile << "    JMP ReverseDone\n";
-        testFile << "\n";
-
-        testFile << "ReverseEmpty:\n";
-        testFile << "    PRINT_STR emptyStringMsg\n";
-        testFile << "\n";
-
-        testFile << "ReverseDone:\n";
-        testFile << "    POP R5\n";
-        testFile << "    POP R4\n";
-        testFile << "    POP R3\n";
-        testFile << "    POP R2\n";
-        testFile << "    POP R1\n";
-        testFile << "    POP R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // ========== STRING CONCATENATION PROCEDURE ==========
-        testFile << "StringConcatenationProcedure:\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    PUSH R1\n";
-        testFile << "    PUSH R2\n";
-        testFile << "    PUSH R3\n";
-        testFile << "    PUSH R4\n";
-        testFile << "    PUSH R5\n";
-        testFile << "\n";
-
-        // Get first string from user
-        testFile << "    PRINT_STR stringPrompt1\n";
-        testFile << "    MOV R3, OFFSET string1\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "    MOV R1, R0\n"; // string1Length = R0
-        testFile << "\n";
-
-        // Get second string from user
-        testFile << "    PRINT_STR stringPrompt2\n";
-        testFile << "    MOV R3, OFFSET string2\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "    MOV R2, R0\n"; // string2Length = R0
-        testFile << "\n";
-
-        // Setup for concatenation - copy first string to result
-        testFile << "    MOV R4, OFFSET string1\n";  // R4 = source 1
-        testFile << "    MOV R5, OFFSET resultString\n"; // R5 = destination
-        testFile << "    MOV R0, 0\n"; // R0 = index counter
-        testFile << "\n";
-
-        // Copy first string to result buffer
-        testFile << "ConcatLoop1:\n";
-        testFile << "    CMP R0, R1\n";
-        testFile << "    JGE ConcatLoop1Done\n";
-        testFile << "    MOVZX R3, BYTE PTR [R4 + R0]\n";
-        testFile << "    MOV BYTE PTR [R5 + R0], R3\n";
-        testFile << "    INC R0\n";
-        testFile << "    JMP ConcatLoop1\n";
-        testFile << "\n";
-
-        testFile << "ConcatLoop1Done:\n";
-        // Now copy second string after the first one
-        testFile << "    MOV R4, OFFSET string2\n"; // R4 = source 2
-        testFile << "    MOV R3, 0\n"; // R3 = index for second string
-        testFile << "\n";
-
-        testFile << "ConcatLoop2:\n";
-        testFile << "    CMP R3, R2\n";
-        testFile << "    JGE ConcatLoop2Done\n";
-        testFile << "    MOVZX R2, BYTE PTR [R4 + R3]\n";
-        testFile << "    MOV BYTE PTR [R5 + R0], R2\n";
-        testFile << "    INC R0\n";
-        testFile << "    INC R3\n";
-        testFile << "    JMP ConcatLoop2\n";
-        testFile << "\n";
-
-        testFile << "ConcatLoop2Done:\n";
-        // Null terminate the concatenated string
-        testFile << "    MOV BYTE PTR [R5 + R0], 0\n";
-        testFile << "\n";
-
-        // Display result to user
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR concatResult\n";
-        testFile << "    PRINT_STR resultString\n";
-        testFile << "    Crlf\n";
-        testFile << "\n";
-
-        testFile << "    POP R5\n";
-        testFile << "    POP R4\n";
-        testFile << "    POP R3\n";
-        testFile << "    POP R2\n";
-        testFile << "    POP R1\n";
-        testFile << "    POP R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // ========== STRING COPY PROCEDURE ==========
-        testFile << "StringCopyProcedure:\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    PUSH R1\n";
-        testFile << "    PUSH R2\n";
-        testFile << "    PUSH R3\n";
-        testFile << "    PUSH R4\n";
-        testFile << "    PUSH R5\n";
-        testFile << "\n";
-
-        // Get source string from user
-        testFile << "    PRINT_STR stringPrompt1\n";
-        testFile << "    MOV R3, OFFSET string1\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "\n";
-
-        // Setup copy operation
-        testFile << "    MOV R4, OFFSET string1\n"; // R4 = source
-        testFile << "    MOV R5, OFFSET copiedString\n"; // R5 = destination
-        testFile << "    MOV R2, R0\n"; // R2 = string length
-        testFile << "    MOV R1, 0\n"; // R1 = index counter
-        testFile << "\n";
-
-        testFile << "CopyLoop:\n";
-        testFile << "    CMP R1, R2\n";
-        testFile << "    JGE CopyDone\n";
-        testFile << "    MOVZX R0, BYTE PTR [R4 + R1]\n";
-        testFile << "    MOV BYTE PTR [R5 + R1], R0\n";
-        testFile << "    INC R1\n";
-        testFile << "    JMP CopyLoop\n";
-        testFile << "\n";
-
-        testFile << "CopyDone:\n";
-        // Null terminate the copied string
-        testFile << "    MOV BYTE PTR [R5 + R1], 0\n";
-        testFile << "\n";
-
-        // Display results to user
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR originalStr\n";
-        testFile << "    PRINT_STR string1\n";
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR copyResult\n";
-        testFile << "    PRINT_STR copiedString\n";
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR copySuccess\n";
-        testFile << "\n";
-
-        testFile << "    POP R5\n";
-        testFile << "    POP R4\n";
-        testFile << "    POP R3\n";
-        testFile << "    POP R2\n";
-        testFile << "    POP R1\n";
-        testFile << "    POP R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-
-        // ========== STRING COMPARE PROCEDURE ==========
-        testFile << "StringCompareProcedure:\n";
-        testFile << "    PUSH R0\n";
-        testFile << "    PUSH R1\n";
-        testFile << "    PUSH R2\n";
-        testFile << "    PUSH R3\n";
-        testFile << "    PUSH R4\n";
-        testFile << "    PUSH R5\n";
-        testFile << "\n";
-
-        // Get first string from user
-        testFile << "    PRINT_STR stringPrompt1\n";
-        testFile << "    MOV R3, OFFSET string1\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "    MOV R1, R0\n"; // string1Length = R0
-        testFile << "\n";
-
-        // Get second string from user
-        testFile << "    PRINT_STR stringPrompt2\n";
-        testFile << "    MOV R3, OFFSET string2\n";
-        testFile << "    CALL ReadUserString\n";
-        testFile << "    MOV R2, R0\n"; // string2Length = R0
-        testFile << "\n";
-
-        // Check if lengths are different
-        testFile << "    CMP R1, R2\n";
-        testFile << "    JNE StringsNotEqual\n";
-        testFile << "\n";
-
-        // Setup comparison - lengths are equal, compare character by character
-        testFile << "    MOV R4, OFFSET string1\n"; // R4 = string1
-        testFile << "    MOV R5, OFFSET string2\n"; // R5 = string2
-        testFile << "    MOV R0, 0\n"; // R0 = index counter
-        testFile << "\n";
-
-        testFile << "CompareLoop:\n";
-        testFile << "    CMP R0, R1\n";
-        testFile << "    JGE StringsEqual\n";
-        testFile << "\n";
-
-        testFile << "    MOVZX R2, BYTE PTR [R4 + R0]\n"; // R2 = string1[index]
-        testFile << "    MOVZX R3, BYTE PTR [R5 + R0]\n"; // R3 = string2[index]
-        testFile << "\n";
-
-        testFile << "    CMP R2, R3\n";
-        testFile << "    JNE StringsNotEqual\n";
-        testFile << "\n";
-
-        // Check if null terminator
-        testFile << "    CMP R2, 0\n";
-        testFile << "    JE StringsEqual\n";
-        testFile << "\n";
-
-        testFile << "    INC R0\n";
-        testFile << "    JMP CompareLoop\n";
-        testFile << "\n";
-
-        testFile << "StringsNotEqual:\n";
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR compareNotEqual\n";
-        testFile << "    JMP CompareDone\n";
-        testFile << "\n";
-
-        testFile << "StringsEqual:\n";
-        testFile << "    Crlf\n";
-        testFile << "    PRINT_STR compareEqual\n";
-        testFile << "\n";
-
-        testFile << "CompareDone:\n";
-        testFile << "    POP R5\n";
-        testFile << "    POP R4\n";
-        testFile << "    POP R3\n";
-        testFile << "    POP R2\n";
-        testFile << "    POP R1\n";
-        testFile << "    POP R0\n";
-        testFile << "    RET\n";
-        testFile << "\n";
-        
+// ========== BENCHMARKS ==========
+// Run with "--bench-dispatch" or "--bench-memory". Benchmark programs run with TRACE_OFF
+// and produce no guest output, so only the timings are printed.
+double TimeDispatch(const string& source, bool threaded, bool fuse, bool jit, unsigned long long& executed) { // Seconds spent in one run
+    VirtualMachine vm(TRACE_OFF);
+    vm.SetSuperinstructions(fuse);
+    vm.SetJit(jit);
+    vm.LoadProgramFromString(source);
+    auto start = chrono::high_resolution_clock::now();
+#if VM_HAVE_COMPUTED_GOTO
+    if (threaded) vm.RunThreaded(); else vm.RunTable();
+#else
+    vm.RunTable();
+#endif
+    auto stop = chrono::high_resolution_clock::now();
+    executed = vm.InstructionsExecuted();                       // Dispatches: a superinstruction counts once
+    return chrono::duration<double>(stop - start).count();
+}
 
-        // memory management module
-        testFile << "; ========== MEMORY MANAGEMENT MODULE ==========\n";
-        testFile << "MemoryModule:\n";
-        testFile << "MemoryMenuLoop:\n";
-        testFile << "    PRINT_STR memoryTitle\n";
-        testFile << "    PRINT_STR memoryMenu\n";
-        testFile << "    READ_INT R0\n";
-        testFile << "    CMP R0, 1\n";
-        testFile << "    JE CreateMatrix\n";
-        testFile << "    CMP R0, 2\n";
-        testFile << "    JE DisplayMatrix\n";
-        testFile << "    CMP R0, 3\n";
-        testFile << "    JE AddMatrices\n";
-        testFile << "    CMP R0, 4\n";
-        testFile << "    JE FreeMemory\n";
-        testFile << "    CMP R0, 5\n";
-        testFile << "    JE MemoryEnd\n";
-        testFile << "    CALL InvalidChoiceMessage\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "\n";
-        testFile << "; ========== CREATE MATRIX PROCEDURE ==========\n";
-        testFile << "CreateMatrix:\n";
-        testFile << "    CMP matrixAllocated, 0\n";
-        testFile << "    JE NoFreeNeeded\n";
-        testFile << "    FREE_ALL_MATRICES\n";
-        testFile << "NoFreeNeeded:\n";
-        testFile << "    PRINT_STR matrixSizePrompt\n";
-        testFile << "    READ_INT R0\n";
-        testFile << "    STORE_MATRIX_SIZE\n";
-        testFile << "    MATRIX_ALLOC_MEM\n";
-        testFile << "    INPUT_MATRIX_A\n";
-        testFile << "    INPUT_MATRIX_B\n";
-        testFile << "    PRINT_STR matrixCreatedMsg\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "\n";
-        testFile << "; ========== DISPLAY MATRIX PROCEDURE ==========\n";
-        testFile << "DisplayMatrix:\n";
-        testFile << "    CMP matrixAllocated, 0\n";
-        testFile << "    JNE MatricesExist\n";
-        testFile << "    PRINT_STR noMatrixMsg\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "MatricesExist:\n";
-        testFile << "    DISPLAY_MATRIX_A\n";
-        testFile << "    DISPLAY_MATRIX_B\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "\n";
-        testFile << "; ========== ADD MATRICES PROCEDURE ==========\n";
-        testFile << "AddMatrices:\n";
-        testFile << "    CMP matrixAllocated, 0\n";
-        testFile << "    JNE CanAddMatrices\n";
-        testFile << "    PRINT_STR noMatrixMsg\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "CanAddMatrices:\n";
-        testFile << "    MATRIX_ADD_OPERATION\n";
-        testFile << "    PRINT_STR matrixAddResult\n";
-        testFile << "    DISPLAY_MATRIX_C\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "\n";
-        testFile << "; ========== FREE MEMORY PROCEDURE ==========\n";
-        testFile << "FreeMemory:\n";
-        testFile << "    CMP matrixAllocated, 0\n";
-        testFile << "    JNE CanFreeMemory\n";
-        testFile << "    PRINT_STR noMatrixMsg\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "CanFreeMemory:\n";
-        testFile << "    FREE_ALL_MATRICES\n";
-        testFile << "    PRINT_STR matrixFreedMsg\n";
-        testFile << "    JMP MemoryMenuLoop\n";
-        testFile << "\n";
-        testFile << "; ========== MEMORY MODULE END ==========\n";
-        testFile << "MemoryEnd:\n";
-        testFile << "    CMP matrixAllocated, 0\n";
-        testFile << "    JE NoCleanupNeeded\n";
-        testFile << "    FREE_ALL_MATRICES\n";
-        testFile << "NoCleanupNeeded:\n";
-        testFile << "    RET\n";
-    
-    testFile.close();
-        
-    vm.LoadProgram("memory_program.asm");
+void RunDispatchBenchmark() {                                   // Cost of table vs threaded dispatch, with and without superinstructions
+    const int iterations = 200000;
+    ostringstream mixed;                                        // ALU loop: dispatch plus typical handler work
+    mixed << "MOV R1, 0\nMOV R2, 0\nBenchLoop:\nADD R2, R1\nSUB R2, 1\nINC R1\nCMP R1, " << iterations << "\nJL BenchLoop\nHALT\n";
+    ostringstream empty;                                        // NOP body: almost pure dispatch
+    empty << "MOV R1, 0\nBenchLoop:\n";
+    for (int i = 0; i < 16; i++) empty << "NOP\n";
+    empty << "INC R1\nCMP R1, " << iterations << "\nJL BenchLoop\nHALT\n";
+    ostringstream copy;                                         // Byte-copy loop of the string routines: the fusion target
+    copy << "MOV R4, 8192\nMOV R5, 16384\nMOV R6, 0\nBenchLoop:\nMOV R0, 0\nCopyLoop:\nCMP R0, 256\nJGE CopyDone\n"
+         << "MOVZX R3, BYTE PTR [R4 + R0]\nMOV BYTE PTR [R5 + R0], R3\nINC R0\nJMP CopyLoop\nCopyDone:\n"
+         << "INC R6\nCMP R6, " << iterations / 256 << "\nJL BenchLoop\nHALT\n";
+
+    const char* names[3] = { "mixed", "empty", "copy" };
+    const string sources[3] = { mixed.str(), empty.str(), copy.str() };
+    const char* units[3] = { "iteration", "iteration", "byte" };    // Total time is reported per unit of guest work, since
+    const double work[3] = { (double)iterations, (double)iterations, (double)(iterations / 256 * 256) }; // fusion changes the dispatch count
+    cout << "=== DISPATCH BENCHMARK ===" << endl;
+    for (int workload = 0; workload < 3; workload++) {
+        for (int threaded = 0; threaded <= VM_HAVE_COMPUTED_GOTO; threaded++) {
+            for (int fuse = 0; fuse <= 1; fuse++) {
+                unsigned long long executed = 0;
+                double seconds = TimeDispatch(sources[workload], threaded != 0, fuse != 0, false, executed);
+                cout << names[workload] << " [" << (threaded ? "threaded" : "table") << (fuse ? ", fused" : "") << "]: "
+                     << executed << " dispatches, " << (seconds * 1e3) << " ms, " << (seconds * 1e9 / executed) << " ns/dispatch, "
+                     << (seconds * 1e9 / work[workload]) << " ns/" << units[workload] << endl;
+            }
+        }
+#if VM_HAVE_JIT
+        unsigned long long executed = 0;                        // Native loop: dispatches are only the JIT entries
+        double seconds = TimeDispatch(sources[workload], VM_HAVE_COMPUTED_GOTO != 0, true, true, executed);
+        cout << names[workload] << " [jit]: " << executed << " dispatches, " << (seconds * 1e3) << " ms, "
+             << (seconds * 1e9 / work[workload]) << " ns/" << units[workload] << endl;
+#endif
+    }
+}
+
+struct HashMapMemory {                                          // Previous backend: one hash node per address (benchmark baseline)
+    unordered_map<int, int> cells;
+
+    int Read(int address, int width = DWORD_SIZE) const {      // Width is ignored: every address holds a whole int
+        auto it = cells.find(address);
+        return (it != cells.end()) ? it->second : 0;
+    }
+
+    void Write(int address, int value, int width = DWORD_SIZE) {
+        cells[address] = value;
+    }
+
+    size_t FootprintBytes() const {                             // Approximate: node (key, value, next, cached hash) + bucket array
+        return cells.size() * (2 * sizeof(int) + sizeof(void*) + sizeof(size_t)) + cells.bucket_count() * sizeof(void*);
+    }
+};
+
+template <typename Memory>
+double TimeStringWorkload(Memory& memory, int rounds) {         // Write a 100-byte string, then reverse-copy it byte by byte
+    const int source = 0x1000, destination = 0x1000 + 100;
+    auto start = chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < 100; i++) memory.Write(source + i, 'a' + (i + round) % 26, BYTE_SIZE);
+        for (int i = 0; i < 100; i++) memory.Write(destination + i, memory.Read(source + 99 - i, BYTE_SIZE), BYTE_SIZE);
+    }
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+template <typename Memory>
+double TimeMatrixWorkload(Memory& memory, int size, int rounds) { // C = A + B over size x size matrices of 4-byte elements
+    const int bytes = size * size * 4;
+    const int addrA = 0x1000, addrB = addrA + bytes, addrC = addrB + bytes;
+    for (int i = 0; i < size * size; i++) {
+        memory.Write(addrA + i * 4, i);
+        memory.Write(addrB + i * 4, 2 * i);
+    }
+    auto start = chrono::high_resolution_clock::now();
+    for (int round = 0; round < rounds; round++) {
+        for (int i = 0; i < size * size; i++) {
+            memory.Write(addrC + i * 4, memory.Read(addrA + i * 4) + memory.Read(addrB + i * 4));
+        }
+    }
+    return chrono::duration<double>(chrono::high_resolution_clock::now() - start).count();
+}
+
+void RunMemoryBenchmark() {                                     // Hash map vs paged backend on string and matrix access patterns
+    const int stringRounds = 20000, matrixSize = 100, matrixRounds = 200;
+    HashMapMemory hashString, hashMatrix;
+    PagedMemory pagedString, pagedMatrix;
+
+    cout << "=== MEMORY BENCHMARK ===" << endl;
+    double hashTime = TimeStringWorkload(hashString, stringRounds);
+    double pagedTime = TimeStringWorkload(pagedString, stringRounds);
+    cout << "string reverse x" << stringRounds << ": hash map " << hashTime * 1000 << " ms, paged " << pagedTime * 1000 << " ms" << endl;
+
+    hashTime = TimeMatrixWorkload(hashMatrix, matrixSize, matrixRounds);
+    pagedTime = TimeMatrixWorkload(pagedMatrix, matrixSize, matrixRounds);
+    cout << matrixSize << "x" << matrixSize << " matrix add x" << matrixRounds << ": hash map " << hashTime * 1000 << " ms, paged " << pagedTime * 1000 << " ms" << endl;
+    cout << "matrix footprint: hash map ~" << hashMatrix.FootprintBytes() / 1024 << " KiB, paged " << pagedMatrix.FootprintBytes() / 1024 << " KiB" << endl;
+}
+
+// ========== JIT DIFFERENTIAL TEST ==========
+// Run with "--test-jit". Random programs over the JIT's instruction subset (with edge-case
+// immediates, memory traffic, forward branches, IDIV by zero and interpreter-only instructions
+// splitting regions) run once interpreted and once with every branch target compiled on its
+// first visit. Registers, flags, PC, the touched memory and the guest output must all match.
+string RandomJitProgram(mt19937& rng) {
+    const int counter = VM_REGISTER_COUNT - 1;                  // Loop counter, base and index registers are reserved
+    const int base = VM_REGISTER_COUNT - 2;                     // so that addresses stay inside the compared range
+    const int index = VM_REGISTER_COUNT - 3;
+    const int freeRegisters = VM_REGISTER_COUNT - 3;
+    static const int edges[] = { 0, 1, -1, 2, -2, 7, 100, INT_MAX, INT_MIN, INT_MAX - 1, INT_MIN + 1, 65535, 255, 256 };
+    static const char* const widths[] = { "BYTE", "WORD", "DWORD" };
+    auto pick = [&](int n) { return (int)(rng() % (unsigned)n); };
+    auto reg = [&]() { return "R" + to_string(pick(freeRegisters)); };
+    auto imm = [&]() { return to_string(pick(3) ? edges[pick(sizeof(edges) / sizeof(edges[0]))] : (int)rng()); };
+    auto value = [&]() { return pick(2) ? reg() : imm(); };
+    auto mnemonic = [&](int first, int last) { return string(OpcodeNames[first + pick(last - first + 1)]); };
+    auto memory = [&](bool narrowOnly) {
+        string width = widths[pick(narrowOnly ? 2 : 3)];
+        return width + " PTR [R" + to_string(base) + " + R" + to_string(index) + " + " + to_string(pick(64)) + "]";
+    };
+
+    ostringstream source;
+    for (int r = 0; r < freeRegisters; r++) source << "MOV R" << r << ", " << imm() << "\n";
+    source << "MOV R" << base << ", 0x2000\nMOV R" << index << ", 0\nMOV R" << counter << ", 0\nTestLoop:\n";
+    vector<pair<string, int>> pending;                          // Forward branch labels and the lines left before them
+    int labelCount = 0;
+    int length = 5 + pick(30);
+    for (int line = 0; line < length; line++) {
+        for (auto it = pending.begin(); it != pending.end();) { // Place labels whose distance has run out
+            if (--it->second <= 0) { source << it->first << ":\n"; it = pending.erase(it); } else ++it;
+        }
+        switch (pick(18)) {
+            case 0:  source << "MOV " << reg() << ", " << value() << "\n"; break;
+            case 1:  source << "ADD " << reg() << ", " << value() << "\n"; break;
+            case 2:  source << "SUB " << reg() << ", " << value() << "\n"; break;
+            case 3:  source << "IMUL " << reg() << ", " << value() << "\n"; break;
+            case 4:  source << "CMP " << value() << ", " << value() << "\n"; break;
+            case 5:  source << (pick(2) ? "INC " : "DEC ") << reg() << "\n"; break;
+            case 6:  source << "IDIV " << (pick(4) ? to_string(pick(2) ? 0 : 3 + pick(1000)) : (pick(2) ? "-7" : "-1")) << "\n"; break; // Overflow faults in both tiers
+            case 7:  source << "MOVZX " << reg() << ", " << memory(true) << "\n"; break;
+            case 8:  source << "MOV " << reg() << ", " << memory(false) << "\n"; break;
+            case 9:  source << "MOV " << memory(false) << ", " << value() << "\n"; break;
+            case 10: source << "MOV R" << index << ", " << pick(200) << "\n"; break;
+            case 11: source << "INC R" << index << "\n"; break;
+            case 12: source << "WRITE_INT " << reg() << "\n"; break; // Interpreter only: splits the region
+            case 13: source << "PUSH " << reg() << "\nPOP " << reg() << "\n"; break;
+            case 14: source << mnemonic(OP_SETE, OP_SETNO) << " " << reg() << "\n"; break;
+            case 15: source << mnemonic(OP_CMOVE, OP_CMOVNO) << " " << reg() << ", " << value() << "\n"; break;
+            default: {                                          // Forward branch (keeps every program finite)
+                string label = "Skip" + to_string(labelCount++);
+                source << (pick(8) ? mnemonic(OP_JE, OP_JNO) : string("JMP")) << " " << label << "\n";
+                pending.push_back(make_pair(label, 1 + pick(6)));
+                break;
+            }
+        }
+    }
+    for (auto& label : pending) source << label.first << ":\n";
+    source << "INC R" << counter << "\nCMP R" << counter << ", " << (2 + pick(40)) << "\nJL TestLoop\nHALT\n";
+    return source.str();
+}
+
+bool RunJitDifferentialTest() {
+    const int programs = 2000;
+    mt19937 rng(20241017);
+    int failures = 0, regions = 0;
+    cout << "=== JIT DIFFERENTIAL TEST ===" << endl;
+    if (!VM_HAVE_JIT) {
+        cout << "JIT not available in this build (VM_HAVE_JIT=0); nothing to compare" << endl;
+        return true;
+    }
+    for (int n = 0; n < programs; n++) {
+        string source = RandomJitProgram(rng);
+        string state[2], output[2];
+        for (int jit = 0; jit <= 1; jit++) {
+            VirtualMachine vm(TRACE_OFF);
+            vm.Output().ToMemory();
+            vm.SetJit(jit != 0);
+            vm.SetJitThreshold(1);
+            vm.LoadProgramFromString(source);
+            vm.run();
+            state[jit] = vm.DescribeState(0x2000, 512);
+            output[jit] = vm.Output().Captured();
+            if (jit) regions += vm.JitRegionCount();
+        }
+        if (state[0] != state[1] || output[0] != output[1]) {
+            if (++failures <= 3) {
+                cout << "MISMATCH in program " << n << ":\n" << source << "--- interpreter ---\n" << state[0] << output[0]
+                     << "\n--- jit ---\n" << state[1] << output[1] << endl;
+            }
+        }
+    }
+    cout << programs << " programs, " << regions << " regions compiled, " << failures << " mismatches" << endl;
+    return failures == 0;
+}
+
+// ========== BUILT-IN MENU PROGRAM ==========
+// The calculator / string / memory menu program run by main(), one source line per entry.
+// It is loaded straight from this table, so startup needs no file I/O.
+static const char* const BuiltinMenuProgram[] = {
+    // Main program structure
+    "START:",
+    "    CALL DisplayWelcome",
+    "    JMP MenuLoop",
+    "    HALT",
+    "",
+    "MenuLoop:",
+    "    CALL DisplayMenu",
+    "    CALL ReadUserChoice",
+    "    CALL ExecuteChoice",
+    "    CALL ScreenClear",
+    "    JMP MenuLoop",
+    "",
+
+    // Core UI procedures
+    "DisplayWelcome:",
+    "    PRINT_STR welcomeMsg",
+    "    RET",
+    "",
+    "DisplayMenu:",
+    "    PRINT_STR menuPrompt",
+    "    RET",
+    "",
+    "ReadUserChoice:",
+    "    READ_INT R0",
+    "    RET",
+    "",
+    "ReadUserString:",
+    "    READ_STRING R0",
+    "    RET",
+    "",
+    "ContinueMessage:",
+    "    PRINT_STR continueMsg",
+    "    RET",
+    "",
+    "ScreenClear:",
+    "    PRINT_STR continueMsg",
+    "    CLRSC",
+    "    RET",
+    "",
+
+    // Choice execution
+    "ExecuteChoice:",
+    "    CMP R0, 1",
+    "    JE CalculatorSection",
+    "    CMP R0, 2",
+    "    JE StringSection",
+    "    CMP R0, 3",
+    "    JE MemorySection",
+    "    CMP R0, 4",
+    "    JE ExitProgram",
+    "    CALL InvalidChoiceMessage",
+    "    RET",
+    "",
+    "InvalidChoiceMessage:",
+    "    PRINT_STR invalidChoiceMsg",
+    "    RET",
+    "",
+    "CalculatorSection:",
+    "    CALL CalculatorModule",
+    "    RET",
+    "",
+    "StringSection:",
+    "    CALL StringModule",
+    "    RET",
+    "MemorySection:",
+    "    CALL MemoryModule",
+    "    RET",
+
+    // EXIT PROGRAM
+    "ExitProgram:",
+    "    HALT",
+    "",
+
+    // Calculator module
+    "; ========== CALCULATOR MODULE ==========",
+    "CalculatorModule:",
+    "CalcMenuLoop:",
+    "    CALL DisplayCalcMenu",
+    "    CALL ReadUserChoice",
+    "    CMP R0, 1",
+    "    JE Addition",
+    "    CMP R0, 2",
+    "    JE Subtraction",
+    "    CMP R0, 3",
+    "    JE Multiplication",
+    "    CMP R0, 4",
+    "    JE Division",
+    "    CMP R0, 5",
+    "    JE CalcEnd",
+    "    CALL InvalidChoiceMessage",
+    "    JMP CalcMenuLoop",
+    "",
+    "Addition:",
+    "    CALL AdditionProcedure",
+    "    JMP AskForNewCalculation",
+    "",
+    "Subtraction:",
+    "    CALL SubtractionProcedure",
+    "    JMP AskForNewCalculation",
+    "",
+    "Multiplication:",
+    "    CALL MultiplicationProcedure",
+    "    JMP AskForNewCalculation",
+    "",
+    "Division:",
+    "    CALL DivisionProcedure",
+    "    JMP AskForNewCalculation",
+    "",
+    "AskForNewCalculation:",
+    "    PRINT_STR newCalcPrompt",
+    "    CALL ReadUserChoice",
+    "    CMP R0, 1",
+    "    JE CalcMenuLoop",
+    "",
+    "CalcEnd:",
+    "    RET",
+    "",
+
+    // Calculator sub-procedures
+    "DisplayCalcMenu:",
+    "    PRINT_STR calcTitle",
+    "    CMP prevResult, 0",
+    "    JE NoPrevResult",
+    "    PRINT_STR calcResult",
+    "    MOV R0, prevResult",
+    "    WRITE_INT R0",
+    "NoPrevResult:",
+    "    PRINT_STR calcMenu",
+    "    RET",
+    "",
+
+    "GetInputNumbers:",
+    "    CMP prevResult, 0",
+    "    JE getFirstNumber",
+    "    PRINT_STR usePrevResult",
+    "    CALL ReadUserChoice",
+    "    MOV usePrev, R0",
+    "    CMP usePrev, 1",
+    "    JNE getFirstNumber",
+    "    MOV R0, prevResult",
+    "    MOV firstNum, R0",
+    "    JMP getsecondNumber",
+    "",
+    "getFirstNumber:",
+    "    PRINT_STR enterFirst",
+    "    CALL ReadUserChoice",
+    "    MOV firstNum, R0",
+    "",
+    "getsecondNumber:",
+    "    PRINT_STR enterSecond",
+    "    CALL ReadUserChoice",
+    "    MOV secondNum, R0",
+    "    RET",
+    "",
+
+    "AdditionProcedure:",
+    "    CALL GetInputNumbers",
+    "    MOV R0, firstNum",
+    "    ADD R0, secondNum",
+    "    MOV prevResult, R0",
+    "    PRINT_STR calcResult",
+    "    WRITE_INT R0", // Display Result
+    "    RET",
+    "",
+
+    "SubtractionProcedure:",
+    "    CALL GetInputNumbers",
+    "    MOV R0, firstNum",
+    "    SUB R0, secondNum",
+    "    MOV prevResult, R0",
+    "    PRINT_STR calcResult",
+    "    WRITE_INT R0", // Display Result
+    "    RET",
+    "",
+
+    "MultiplicationProcedure:",
+    "    CALL GetInputNumbers",
+    "    MOV R0, firstNum",
+    "    IMUL R0, secondNum",
+    "    MOV prevResult, R0",
+    "    PRINT_STR calcResult",
+    "    WRITE_INT R0", // Display Result
+    "    RET",
+    "",
+
+    "DivisionProcedure:",
+    "    CALL GetInputNumbers",
+    "    CMP secondNum, 0",
+    "    JNE PerfromDivision",
+    "    PRINT_STR divByZeroMsg",
+    "    RET",
+    "",
+
+    "PerfromDivision:",
+    "    MOV R0, firstNum",
+    "    CDQ",
+    "    MOV R1, secondNum",
+    "    IDIV R1",
+    "    MOV prevResult, R0",
+    "    MOV remainder, R1",
+    "    PRINT_STR calcResult",
+    "    WRITE_INT R0", // Display Result
+    "    MOV R0, remainder",
+    "    PRINT_STR remainderMsg",
+    "   WRITE_INT R0", // Display Remainder Result
+    "    RET",
+    "",
+
+
+    // String manipulation module
+    "; ========== STRING MANIPULATION MODULE ==========",
+    "StringModule:",
+    "    PUSHM R0-R2",
+    "StringMenuLoop:",
+    "    CALL DisplayStringMenu",
+    "    CALL ReadUserChoice",
+    "    CMP R0, 1",
+    "    JE StringReverse",
+    "    CMP R0, 2",
+    "    JE StringConcatenation",
+    "    CMP R0, 3",
+    "    JE StringCopy",
+    "    CMP R0, 4",
+    "    JE StringCompare",
+    "    CMP R0, 5",
+    "    JE StringEnd",
+    "    CALL InvalidChoiceMessage",
+    "    JMP StringMenuLoop",
+    "",
+    "StringReverse:",
+    "    CALL StringReverseProcedure",
+    "    JMP StringMenuLoop",
+    "",
+    "StringConcatenation:",
+    "    CALL StringConcatenationProcedure",
+    "    JMP StringMenuLoop",
+    "",
+    "StringCopy:",
+    "    CALL StringCopyProcedure",
+    "    JMP StringMenuLoop",
+    "",
+    "StringCompare:",
+    "    CALL StringCompareProcedure",
+    "    JMP StringMenuLoop",
+    "",
+    "StringEnd:",
+    "    POPM R0-R2",
+    "    RET",
+    "",
+
+    // String menu display
+    "DisplayStringMenu:",
+    "    PUSH R3",
+    "    PRINT_STR stringTitle",
+    "    PRINT_STR stringMenu",
+    "    POP R3",
+    "    RET",
+    "",
+
+    // String buffers (allocated when the program is loaded)
+    "BUFFER string1, 100",
+    "BUFFER string2, 100",
+    "BUFFER resultString, 200", // Holds string1 + string2
+    "BUFFER reversedString, 100",
+    "BUFFER copiedString, 100",
+    "",
+
+    // String operation procedures
+    "StringReverseProcedure:",
+    "    PUSHA",
+    "    PRINT_STR stringPrompt1",
+    "    MOV R3, OFFSET string1",
+    "    CALL ReadUserString",
+    "    CMP R0, 0",
+    "    JE ReverseEmpty",
+    "    STRREV reversedString, string1", // Reversed copy, NUL terminated
+    "",
+
+    // Display results
+    "    Crlf",
+    "    PRINT_STR originalStr",
+    "    PRINT_STR string1",
+    "    Crlf",
+    "    PRINT_STR reversedStr",
+    "    PRINT_STR reversedString",
+    "    Crlf",
+    "    JMP ReverseDone",
+    "",
+
+    "ReverseEmpty:",
+    "    PRINT_STR emptyStringMsg",
+    "",
+
+    "ReverseDone:",
+    "    POPA",
+    "    RET",
+    "",
+
+    // ========== STRING CONCATENATION PROCEDURE ==========
+    "StringConcatenationProcedure:",
+    "    PUSHA",
+    "",
+
+    // Get first string from user
+    "    PRINT_STR stringPrompt1",
+    "    MOV R3, OFFSET string1",
+    "    CALL ReadUserString",
+    "",
+
+    // Get second string from user
+    "    PRINT_STR stringPrompt2",
+    "    MOV R3, OFFSET string2",
+    "    CALL ReadUserString",
+    "",
+
+    // Copy the first string to the result buffer, then append the second one
+    "    STRCPY resultString, string1",
+    "    STRCAT resultString, string2", // R0 = combined length
+    "",
+
+    // Display result to user
+    "    Crlf",
+    "    PRINT_STR concatResult",
+    "    PRINT_STR resultString",
+    "    Crlf",
+    "",
+
+    "    POPA",
+    "    RET",
+    "",
+
+    // ========== STRING COPY PROCEDURE ==========
+    "StringCopyProcedure:",
+    "    PUSHA",
+    "",
+
+    // Get source string from user
+    "    PRINT_STR stringPrompt1",
+    "    MOV R3, OFFSET string1",
+    "    CALL ReadUserString",
+    "",
+
+    // Copy including the NUL terminator
+    "    STRCPY copiedString, string1",
+    "",
+
+    // Display results to user
+    "    Crlf",
+    "    PRINT_STR originalStr",
+    "    PRINT_STR string1",
+    "    Crlf",
+    "    PRINT_STR copyResult",
+    "    PRINT_STR copiedString",
+    "    Crlf",
+    "    PRINT_STR copySuccess",
+    "",
+
+    "    POPA",
+    "    RET",
+    "",
+
+    // ========== STRING COMPARE PROCEDURE ==========
+    "StringCompareProcedure:",
+    "    PUSHA",
+    "",
+
+    // Get first string from user
+    "    PRINT_STR stringPrompt1",
+    "    MOV R3, OFFSET string1",
+    "    CALL ReadUserString",
+    "",
+
+    // Get second string from user
+    "    PRINT_STR stringPrompt2",
+    "    MOV R3, OFFSET string2",
+    "    CALL ReadUserString",
+    "",
+
+    // Compare both strings in one step (ZF = equal)
+    "    STRCMP string1, string2",
+    "    JE StringsEqual",
+    "",
+
+    "StringsNotEqual:",
+    "    Crlf",
+    "    PRINT_STR compareNotEqual",
+    "    JMP CompareDone",
+    "",
+
+    "StringsEqual:",
+    "    Crlf",
+    "    PRINT_STR compareEqual",
+    "",
+
+    "CompareDone:",
+    "    POPA",
+    "    RET",
+    "",
+
+
+    // memory management module
+    "; ========== MEMORY MANAGEMENT MODULE ==========",
+    "MemoryModule:",
+    "MemoryMenuLoop:",
+    "    PRINT_STR memoryTitle",
+    "    PRINT_STR memoryMenu",
+    "    READ_INT R0",
+    "    CMP R0, 1",
+    "    JE CreateMatrix",
+    "    CMP R0, 2",
+    "    JE DisplayMatrix",
+    "    CMP R0, 3",
+    "    JE AddMatrices",
+    "    CMP R0, 4",
+    "    JE FreeMemory",
+    "    CMP R0, 5",
+    "    JE MemoryEnd",
+    "    CALL InvalidChoiceMessage",
+    "    JMP MemoryMenuLoop",
+    "",
+    "; ========== CREATE MATRIX PROCEDURE ==========",
+    "CreateMatrix:",
+    "    CMP matrixAllocated, 0",
+    "    JE NoFreeNeeded",
+    "    FREE_ALL_MATRICES",
+    "NoFreeNeeded:",
+    "    PRINT_STR matrixSizePrompt",
+    "    READ_INT R0",
+    "    STORE_MATRIX_SIZE",
+    "    MATRIX_ALLOC_MEM",
+    "    INPUT_MATRIX_A",
+    "    INPUT_MATRIX_B",
+    "    PRINT_STR matrixCreatedMsg",
+    "    JMP MemoryMenuLoop",
+    "",
+    "; ========== DISPLAY MATRIX PROCEDURE ==========",
+    "DisplayMatrix:",
+    "    CMP matrixAllocated, 0",
+    "    JNE MatricesExist",
+    "    PRINT_STR noMatrixMsg",
+    "    JMP MemoryMenuLoop",
+    "MatricesExist:",
+    "    DISPLAY_MATRIX_A",
+    "    DISPLAY_MATRIX_B",
+    "    JMP MemoryMenuLoop",
+    "",
+    "; ========== ADD MATRICES PROCEDURE ==========",
+    "AddMatrices:",
+    "    CMP matrixAllocated, 0",
+    "    JNE CanAddMatrices",
+    "    PRINT_STR noMatrixMsg",
+    "    JMP MemoryMenuLoop",
+    "CanAddMatrices:",
+    "    MATRIX_ADD_OPERATION",
+    "    PRINT_STR matrixAddResult",
+    "    DISPLAY_MATRIX_C",
+    "    JMP MemoryMenuLoop",
+    "",
+    "; ========== FREE MEMORY PROCEDURE ==========",
+    "FreeMemory:",
+    "    CMP matrixAllocated, 0",
+    "    JNE CanFreeMemory",
+    "    PRINT_STR noMatrixMsg",
+    "    JMP MemoryMenuLoop",
+    "CanFreeMemory:",
+    "    FREE_ALL_MATRICES",
+    "    PRINT_STR matrixFreedMsg",
+    "    JMP MemoryMenuLoop",
+    "",
+    "; ========== MEMORY MODULE END ==========",
+    "MemoryEnd:",
+    "    CMP matrixAllocated, 0",
+    "    JE NoCleanupNeeded",
+    "    FREE_ALL_MATRICES",
+    "NoCleanupNeeded:",
+    "    RET",
+};
+
+// ========== BYTECODE VALIDATION TEST ==========
+// Run with "--test-bytecode". Corrupted images must be refused with a load error, never run:
+// operands of a small program are given the wrong kind, count or value (each case must be rejected and
+// must leave the VM with nothing to run), then random bytes of the built-in program's code section
+// are overwritten (loading must not crash).
+struct ImageCorruption {
+    const char* description;
+    int instruction;                                            // Index in the test program
+    void (*corrupt)(Instruction& ins);
+};
+
+bool LoadsImage(const vector<uint8_t>& image) {                 // True if a fresh VM accepts the image
+    VirtualMachine vm(TRACE_OFF);
+    bool loaded = vm.LoadBytecodeImage(image.data(), image.size());
+    return loaded && vm.LoadErrors().empty();
+}
+
+bool RunsAfterFailedLoad(const vector<uint8_t>& good, const vector<uint8_t>& bad) { // True if the earlier program survives a rejected image
+    VirtualMachine vm(TRACE_OFF);
+    vm.Output().ToMemory();
+    vm.LoadBytecodeImage(good.data(), good.size());
+    if (vm.LoadBytecodeImage(bad.data(), bad.size())) return false;
+    vm.run();
+    return !vm.Output().Captured().empty();
+}
+
+Instruction* ImageInstruction(vector<uint8_t>& image, int index) { // Instruction index of an image's code section
+    BytecodeHeader header;
+    memcpy(&header, image.data(), sizeof(header));
+    return (Instruction*)(image.data() + header.codeOffset) + index;
+}
+
+bool RunBytecodeValidationTest() {
+    static const ImageCorruption cases[] = {
+        { "ADD into an immediate",          0, [](Instruction& ins) { ins.ops[0].kind = OPND_IMM; ins.ops[0].value = 100000000; } },
+        { "ADD with one operand",           0, [](Instruction& ins) { ins.operandCount = 1; ins.ops[1] = Operand{}; } },
+        { "ADD with a stray operand slot",  0, [](Instruction& ins) { ins.operandCount = 1; } },
+        { "PRINT_STR of a register",        1, [](Instruction& ins) { ins.ops[0].kind = OPND_REG; ins.ops[0].value = 0; } },
+        { "PRINT_STR without operands",     1, [](Instruction& ins) { ins.operandCount = 0; ins.ops[0] = Operand{}; } },
+        { "MOV with three operands",        2, [](Instruction& ins) { ins.operandCount = 3; ins.ops[2].kind = OPND_REG; } },
+        { "MOV from a label",               2, [](Instruction& ins) { ins.ops[1].kind = OPND_LABEL; ins.ops[1].value = 0; ins.ops[1].aux = 0; } },
+        { "MOV into a symbol",              2, [](Instruction& ins) { ins.ops[0].kind = OPND_SYMBOL; ins.ops[0].value = 0; } },
+        { "JE to an immediate",             3, [](Instruction& ins) { ins.ops[0].kind = OPND_IMM; } },
+        { "REP prefix out of range",        4, [](Instruction& ins) { ins.ops[0].value = 7; } },
+        { "HALT with an operand",           5, [](Instruction& ins) { ins.operandCount = 1; ins.ops[0].kind = OPND_REG; } },
+        { "PUSHM with an empty mask",       6, [](Instruction& ins) { ins.ops[0].value = 0; } },
+        { "PUSHM past the register file",   6, [](Instruction& ins) { ins.ops[0].value = VM_REGISTER_COUNT < 32 ? (int32_t)(1u << (VM_REGISTER_COUNT & 31)) : 0; } },
+    };
+    cout << "=== BYTECODE VALIDATION TEST ===" << endl;
+    VirtualMachine assembler(TRACE_OFF);
+    assembler.LoadProgramFromString("ADD R0, 5\nPRINT_STR welcomeMsg\nMOV R1, R0\nJE Done\nREP MOVSB\nDone:\nHALT\nPUSHM R0-R2\n");
+    vector<uint8_t> image = assembler.BuildBytecodeImage(false);
+    int failures = 0;
+    if (!LoadsImage(image)) {
+        cout << "FAILED: the uncorrupted image was rejected" << endl;
+        failures++;
+    }
+    for (const ImageCorruption& test : cases) {
+        vector<uint8_t> corrupted = image;
+        test.corrupt(*ImageInstruction(corrupted, test.instruction));
+        if (LoadsImage(corrupted)) {
+            cout << "FAILED: accepted " << test.description << endl;
+            failures++;
+        } else if (RunsAfterFailedLoad(image, corrupted)) {
+            cout << "FAILED: previous program still runs after rejecting " << test.description << endl;
+            failures++;
+        }
+    }
+
+    VirtualMachine builtin(TRACE_OFF);                          // Random corruptions: every image is either refused or well formed
+    builtin.LoadProgramFromLines(BuiltinMenuProgram, sizeof(BuiltinMenuProgram) / sizeof(BuiltinMenuProgram[0]));
+    vector<uint8_t> menu = builtin.BuildBytecodeImage(false);
+    BytecodeHeader header;
+    memcpy(&header, menu.data(), sizeof(header));
+    mt19937 rng(20241017);
+    const int corruptions = 20000;
+    int rejected = 0;
+    for (int n = 0; n < corruptions; n++) {
+        vector<uint8_t> corrupted = menu;
+        size_t at = header.codeOffset + rng() % (header.codeCount * sizeof(Instruction));
+        corrupted[at] = (uint8_t)rng();
+        if (!LoadsImage(corrupted)) rejected++;
+    }
+    cout << (sizeof(cases) / sizeof(cases[0])) << " targeted corruptions, " << failures << " failed; "
+         << corruptions << " random corruptions, " << rejected << " rejected" << endl;
+    return failures == 0;
+}
+
+#ifndef VM_NO_MAIN                                             // Tools such as Assembler.cpp include this file and bring their own main
+int main(int argc, char* argv[]) {
+    TraceLevel traceLevel = TRACE_FULL;
+    string programPath;                                         // Empty: run the built-in menu program
+    string outputPath;                                          // Empty: guest output goes to stdout
+    string inputPath;                                           // Empty: guest input comes from stdin
+    bool batch = false;
+    bool fuse = true;                                           // Superinstructions, unless --no-fuse
+    bool jit = false;                                           // Native code for hot regions (--jit)
+    bool guestStack = false;                                    // Data stack in guest memory, R(N-1) = ESP (--guest-stack)
+    uint32_t jitThreshold = VM_JIT_THRESHOLD;                   // Visits before a branch target is compiled (--jit-threshold=N)
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg == "--bench-dispatch") {                        // Benchmark modes instead of the interactive program
+            RunDispatchBenchmark();
+            return 0;
+        }
+        if (arg == "--bench-memory") {
+            RunMemoryBenchmark();
+            return 0;
+        }
+        if (arg == "--test-jit") {
+            return RunJitDifferentialTest() ? 0 : 1;
+        }
+        if (arg == "--test-bytecode") {
+            return RunBytecodeValidationTest() ? 0 : 1;
+        }
+        if (arg.compare(0, 8, "--trace=") == 0 && !VirtualMachine::ParseTraceLevel(arg.substr(8), traceLevel)) {
+            cerr << "Unknown trace level '" << arg.substr(8) << "' (use off, errors, calls, full or debug)" << endl;
+            return 1;
+        }
+        if (arg.compare(0, 9, "--output=") == 0) outputPath = arg.substr(9);
+        if (arg.compare(0, 8, "--input=") == 0) inputPath = arg.substr(8);
+        if (arg == "--batch") batch = true;
+        if (arg == "--no-fuse") fuse = false;
+        if (arg == "--jit") jit = true;
+        if (arg == "--guest-stack") guestStack = true;
+        if (arg.compare(0, 16, "--jit-threshold=") == 0) {
+            char* end = nullptr;
+            unsigned long visits = strtoul(arg.c_str() + 16, &end, 10);
+            if (*end != '\0' || end == arg.c_str() + 16 || visits == 0 || visits > UINT32_MAX || arg[16] == '-') {
+                cerr << "Invalid JIT threshold '" << arg.substr(16) << "' (use a visit count from 1 to " << UINT32_MAX << ")" << endl;
+                return 1;
+            }
+            jitThreshold = (uint32_t)visits;
+        }
+        if (arg.compare(0, 10, "--program=") == 0) programPath = arg.substr(10);
+    }
+    VirtualMachine vm(traceLevel);
+    if (!outputPath.empty() && !vm.Output().ToFile(outputPath)) {
+        cerr << "Cannot open output file '" << outputPath << "'" << endl;
+        return 1;
+    }
+    if (!inputPath.empty() && !vm.InputFromFile(inputPath)) {
+        cerr << "Cannot open input file '" << inputPath << "'" << endl;
+        return 1;
+    }
+    vm.SetBatchMode(batch);
+    vm.SetSuperinstructions(fuse);
+    vm.SetJit(jit);
+    vm.SetJitThreshold(jitThreshold);
+    if (jit && traceLevel >= TRACE_FULL) {                      // Native code cannot trace each instruction
+        cerr << "Note: --jit has no effect at --trace=" << TraceLevelNames[traceLevel] << "; use --trace=calls or lower" << endl;
+    }
+    vm.SetGuestDataStack(guestStack);
+    bool loaded = programPath.empty()
+        ? vm.LoadProgramFromLines(BuiltinMenuProgram, sizeof(BuiltinMenuProgram) / sizeof(BuiltinMenuProgram[0]))
+        : vm.LoadProgram(programPath);                          // .asm source or .vmbc image
+    if (!loaded) {
+        for (const string& error : vm.LoadErrors()) cerr << "Load error: " << error << endl;
+        return 1;
+    }
     vm.run();
-    
+    if (!vm.FaultMessage().empty()) {                           // Stack overflow/underflow stopped the guest
+        cerr << "Guest fault: " << vm.FaultMessage() << endl;
+        return 1;
+    }
     return 0;
 }
+#endif